@@ -11,97 +11,302 @@ Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
 // gvr_marker_call_rate
-NumericVector gvr_marker_call_rate(NumericMatrix geno);
-RcppExport SEXP _easybreedeR_gvr_marker_call_rate(SEXP genoSEXP) {
+NumericVector gvr_marker_call_rate(SEXP geno, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_marker_call_rate(SEXP genoSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_marker_call_rate(geno));
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_marker_call_rate(geno, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_individual_call_rate
-NumericVector gvr_individual_call_rate(NumericMatrix geno);
-RcppExport SEXP _easybreedeR_gvr_individual_call_rate(SEXP genoSEXP) {
+NumericVector gvr_individual_call_rate(SEXP geno, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_individual_call_rate(SEXP genoSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_individual_call_rate(geno));
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_individual_call_rate(geno, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_maf
-NumericVector gvr_maf(NumericMatrix geno);
-RcppExport SEXP _easybreedeR_gvr_maf(SEXP genoSEXP) {
+NumericVector gvr_maf(SEXP geno, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_maf(SEXP genoSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_maf(geno));
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_maf(geno, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_individual_het
-NumericVector gvr_individual_het(NumericMatrix geno);
-RcppExport SEXP _easybreedeR_gvr_individual_het(SEXP genoSEXP) {
+NumericVector gvr_individual_het(SEXP geno, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_individual_het(SEXP genoSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_individual_het(geno));
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_individual_het(geno, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_marker_het
-NumericVector gvr_marker_het(NumericMatrix geno);
-RcppExport SEXP _easybreedeR_gvr_marker_het(SEXP genoSEXP) {
+NumericVector gvr_marker_het(SEXP geno, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_marker_het(SEXP genoSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_marker_het(geno));
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_marker_het(geno, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_hwe_exact
-NumericVector gvr_hwe_exact(NumericMatrix geno);
-RcppExport SEXP _easybreedeR_gvr_hwe_exact(SEXP genoSEXP) {
+NumericVector gvr_hwe_exact(SEXP geno, int n_threads, bool midp);
+RcppExport SEXP _easybreedeR_gvr_hwe_exact(SEXP genoSEXP, SEXP n_threadsSEXP, SEXP midpSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_hwe_exact(geno));
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type midp(midpSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_hwe_exact(geno, n_threads, midp));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_qc_summary
+List gvr_qc_summary(SEXP geno, int n_threads, bool hwe_midp);
+RcppExport SEXP _easybreedeR_gvr_qc_summary(SEXP genoSEXP, SEXP n_threadsSEXP, SEXP hwe_midpSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type hwe_midp(hwe_midpSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_qc_summary(geno, n_threads, hwe_midp));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_relatedness_pairs
-DataFrame gvr_relatedness_pairs(NumericMatrix geno, CharacterVector sample_ids, int max_pairs, int max_markers, int min_valid, bool show_progress);
-RcppExport SEXP _easybreedeR_gvr_relatedness_pairs(SEXP genoSEXP, SEXP sample_idsSEXP, SEXP max_pairsSEXP, SEXP max_markersSEXP, SEXP min_validSEXP, SEXP show_progressSEXP) {
+SEXP gvr_relatedness_pairs(SEXP geno, CharacterVector sample_ids, int max_pairs, int max_markers, int min_valid, bool show_progress, double em_min_pi_hat, int n_threads, double min_pi_hat, int top_k, std::string out_path, std::string out_format, LogicalVector marker_keep);
+RcppExport SEXP _easybreedeR_gvr_relatedness_pairs(SEXP genoSEXP, SEXP sample_idsSEXP, SEXP max_pairsSEXP, SEXP max_markersSEXP, SEXP min_validSEXP, SEXP show_progressSEXP, SEXP em_min_pi_hatSEXP, SEXP n_threadsSEXP, SEXP min_pi_hatSEXP, SEXP top_kSEXP, SEXP out_pathSEXP, SEXP out_formatSEXP, SEXP marker_keepSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type sample_ids(sample_idsSEXP);
     Rcpp::traits::input_parameter< int >::type max_pairs(max_pairsSEXP);
     Rcpp::traits::input_parameter< int >::type max_markers(max_markersSEXP);
     Rcpp::traits::input_parameter< int >::type min_valid(min_validSEXP);
     Rcpp::traits::input_parameter< bool >::type show_progress(show_progressSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_relatedness_pairs(geno, sample_ids, max_pairs, max_markers, min_valid, show_progress));
+    Rcpp::traits::input_parameter< double >::type em_min_pi_hat(em_min_pi_hatSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< double >::type min_pi_hat(min_pi_hatSEXP);
+    Rcpp::traits::input_parameter< int >::type top_k(top_kSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_path(out_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_format(out_formatSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type marker_keep(marker_keepSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_relatedness_pairs(geno, sample_ids, max_pairs, max_markers, min_valid, show_progress, em_min_pi_hat, n_threads, min_pi_hat, top_k, out_path, out_format, marker_keep));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_read_relatedness_bin
+DataFrame gvr_read_relatedness_bin(std::string path, CharacterVector sample_ids);
+RcppExport SEXP _easybreedeR_gvr_read_relatedness_bin(SEXP pathSEXP, SEXP sample_idsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sample_ids(sample_idsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_read_relatedness_bin(path, sample_ids));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_pca_from_dosage_cpp
-SEXP gvr_pca_from_dosage_cpp(NumericMatrix geno, int n_components, int max_markers);
-RcppExport SEXP _easybreedeR_gvr_pca_from_dosage_cpp(SEXP genoSEXP, SEXP n_componentsSEXP, SEXP max_markersSEXP) {
+SEXP gvr_pca_from_dosage_cpp(SEXP geno, int n_components, int max_markers, int n_threads, bool streaming, LogicalVector marker_keep);
+RcppExport SEXP _easybreedeR_gvr_pca_from_dosage_cpp(SEXP genoSEXP, SEXP n_componentsSEXP, SEXP max_markersSEXP, SEXP n_threadsSEXP, SEXP streamingSEXP, SEXP marker_keepSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
     Rcpp::traits::input_parameter< int >::type n_components(n_componentsSEXP);
     Rcpp::traits::input_parameter< int >::type max_markers(max_markersSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_pca_from_dosage_cpp(geno, n_components, max_markers));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type streaming(streamingSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type marker_keep(marker_keepSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_pca_from_dosage_cpp(geno, n_components, max_markers, n_threads, streaming, marker_keep));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_grm
+SEXP gvr_grm(SEXP geno, CharacterVector sample_ids, std::string out_prefix, std::string out_format, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_grm(SEXP genoSEXP, SEXP sample_idsSEXP, SEXP out_prefixSEXP, SEXP out_formatSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sample_ids(sample_idsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_prefix(out_prefixSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_format(out_formatSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_grm(geno, sample_ids, out_prefix, out_format, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_read_grm
+NumericMatrix gvr_read_grm(std::string prefix);
+RcppExport SEXP _easybreedeR_gvr_read_grm(SEXP prefixSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type prefix(prefixSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_read_grm(prefix));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_ld_prune
+LogicalVector gvr_ld_prune(SEXP geno, CharacterVector chr, NumericVector bp, int window, int step, double r2_threshold, double window_bp, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_ld_prune(SEXP genoSEXP, SEXP chrSEXP, SEXP bpSEXP, SEXP windowSEXP, SEXP stepSEXP, SEXP r2_thresholdSEXP, SEXP window_bpSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type chr(chrSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type bp(bpSEXP);
+    Rcpp::traits::input_parameter< int >::type window(windowSEXP);
+    Rcpp::traits::input_parameter< int >::type step(stepSEXP);
+    Rcpp::traits::input_parameter< double >::type r2_threshold(r2_thresholdSEXP);
+    Rcpp::traits::input_parameter< double >::type window_bp(window_bpSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_ld_prune(geno, chr, bp, window, step, r2_threshold, window_bp, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_qc_filter
+List gvr_qc_filter(SEXP geno, double geno_threshold, double mind_threshold, double maf_threshold, double hwe_threshold, bool hwe_midp, std::string out_prefix, std::string bim_path, std::string fam_path, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_qc_filter(SEXP genoSEXP, SEXP geno_thresholdSEXP, SEXP mind_thresholdSEXP, SEXP maf_thresholdSEXP, SEXP hwe_thresholdSEXP, SEXP hwe_midpSEXP, SEXP out_prefixSEXP, SEXP bim_pathSEXP, SEXP fam_pathSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< double >::type geno_threshold(geno_thresholdSEXP);
+    Rcpp::traits::input_parameter< double >::type mind_threshold(mind_thresholdSEXP);
+    Rcpp::traits::input_parameter< double >::type maf_threshold(maf_thresholdSEXP);
+    Rcpp::traits::input_parameter< double >::type hwe_threshold(hwe_thresholdSEXP);
+    Rcpp::traits::input_parameter< bool >::type hwe_midp(hwe_midpSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_prefix(out_prefixSEXP);
+    Rcpp::traits::input_parameter< std::string >::type bim_path(bim_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type fam_path(fam_pathSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_qc_filter(geno, geno_threshold, mind_threshold, maf_threshold, hwe_threshold, hwe_midp, out_prefix, bim_path, fam_path, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_stats_cache
+SEXP gvr_stats_cache(SEXP geno, LogicalVector sample_keep, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_stats_cache(SEXP genoSEXP, SEXP sample_keepSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type sample_keep(sample_keepSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_stats_cache(geno, sample_keep, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_stats_cache_update
+List gvr_stats_cache_update(SEXP cache, LogicalVector sample_keep, bool hwe_midp, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_stats_cache_update(SEXP cacheSEXP, SEXP sample_keepSEXP, SEXP hwe_midpSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type cache(cacheSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type sample_keep(sample_keepSEXP);
+    Rcpp::traits::input_parameter< bool >::type hwe_midp(hwe_midpSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_stats_cache_update(cache, sample_keep, hwe_midp, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_pack_genotypes
+SEXP gvr_pack_genotypes(NumericMatrix geno);
+RcppExport SEXP _easybreedeR_gvr_pack_genotypes(SEXP genoSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type geno(genoSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_pack_genotypes(geno));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_pack_bed
+SEXP gvr_pack_bed(std::string bed_path, int n_samples, int n_markers);
+RcppExport SEXP _easybreedeR_gvr_pack_bed(SEXP bed_pathSEXP, SEXP n_samplesSEXP, SEXP n_markersSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bed_path(bed_pathSEXP);
+    Rcpp::traits::input_parameter< int >::type n_samples(n_samplesSEXP);
+    Rcpp::traits::input_parameter< int >::type n_markers(n_markersSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_pack_bed(bed_path, n_samples, n_markers));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_read_plink_bfile
+List gvr_read_plink_bfile(std::string bed_path, std::string bim_path, std::string fam_path);
+RcppExport SEXP _easybreedeR_gvr_read_plink_bfile(SEXP bed_pathSEXP, SEXP bim_pathSEXP, SEXP fam_pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bed_path(bed_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type bim_path(bim_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type fam_path(fam_pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_read_plink_bfile(bed_path, bim_path, fam_path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_genotype_view
+SEXP gvr_genotype_view(SEXP geno, LogicalVector sample_keep, LogicalVector marker_keep);
+RcppExport SEXP _easybreedeR_gvr_genotype_view(SEXP genoSEXP, SEXP sample_keepSEXP, SEXP marker_keepSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type geno(genoSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type sample_keep(sample_keepSEXP);
+    Rcpp::traits::input_parameter< LogicalVector >::type marker_keep(marker_keepSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_genotype_view(geno, sample_keep, marker_keep));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_packed_info
+List gvr_packed_info(SEXP store);
+RcppExport SEXP _easybreedeR_gvr_packed_info(SEXP storeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store(storeSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_packed_info(store));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_unpack_genotypes
+NumericMatrix gvr_unpack_genotypes(SEXP store);
+RcppExport SEXP _easybreedeR_gvr_unpack_genotypes(SEXP storeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store(storeSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_unpack_genotypes(store));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -245,83 +450,164 @@ BEGIN_RCPP
 END_RCPP
 }
 // eb_ped_to_blup_codes_cpp
-List eb_ped_to_blup_codes_cpp(CharacterMatrix allele1, CharacterMatrix allele2, std::string counted_allele);
-RcppExport SEXP _easybreedeR_eb_ped_to_blup_codes_cpp(SEXP allele1SEXP, SEXP allele2SEXP, SEXP counted_alleleSEXP) {
+List eb_ped_to_blup_codes_cpp(CharacterMatrix allele1, CharacterMatrix allele2, std::string counted_allele, std::string output, int n_threads);
+RcppExport SEXP _easybreedeR_eb_ped_to_blup_codes_cpp(SEXP allele1SEXP, SEXP allele2SEXP, SEXP counted_alleleSEXP, SEXP outputSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< CharacterMatrix >::type allele1(allele1SEXP);
     Rcpp::traits::input_parameter< CharacterMatrix >::type allele2(allele2SEXP);
     Rcpp::traits::input_parameter< std::string >::type counted_allele(counted_alleleSEXP);
-    rcpp_result_gen = Rcpp::wrap(eb_ped_to_blup_codes_cpp(allele1, allele2, counted_allele));
+    Rcpp::traits::input_parameter< std::string >::type output(outputSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(eb_ped_to_blup_codes_cpp(allele1, allele2, counted_allele, output, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
-// gvr_call_rate_from_ped_strings_cpp
-List gvr_call_rate_from_ped_strings_cpp(CharacterMatrix geno_pairs);
-RcppExport SEXP _easybreedeR_gvr_call_rate_from_ped_strings_cpp(SEXP geno_pairsSEXP) {
+// eb_ped_file_to_blup_codes_cpp
+List eb_ped_file_to_blup_codes_cpp(std::string ped_path, std::string map_path, std::string counted_allele, std::string output);
+RcppExport SEXP _easybreedeR_eb_ped_file_to_blup_codes_cpp(SEXP ped_pathSEXP, SEXP map_pathSEXP, SEXP counted_alleleSEXP, SEXP outputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type ped_path(ped_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type map_path(map_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type counted_allele(counted_alleleSEXP);
+    Rcpp::traits::input_parameter< std::string >::type output(outputSEXP);
+    rcpp_result_gen = Rcpp::wrap(eb_ped_file_to_blup_codes_cpp(ped_path, map_path, counted_allele, output));
+    return rcpp_result_gen;
+END_RCPP
+}
+// eb_bed_to_blupf90_cpp
+List eb_bed_to_blupf90_cpp(std::string bed_path, std::string bim_path, std::string fam_path, std::string out_prefix, std::string counted_allele, bool fixed_width, std::string compress);
+RcppExport SEXP _easybreedeR_eb_bed_to_blupf90_cpp(SEXP bed_pathSEXP, SEXP bim_pathSEXP, SEXP fam_pathSEXP, SEXP out_prefixSEXP, SEXP counted_alleleSEXP, SEXP fixed_widthSEXP, SEXP compressSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bed_path(bed_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type bim_path(bim_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type fam_path(fam_pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type out_prefix(out_prefixSEXP);
+    Rcpp::traits::input_parameter< std::string >::type counted_allele(counted_alleleSEXP);
+    Rcpp::traits::input_parameter< bool >::type fixed_width(fixed_widthSEXP);
+    Rcpp::traits::input_parameter< std::string >::type compress(compressSEXP);
+    rcpp_result_gen = Rcpp::wrap(eb_bed_to_blupf90_cpp(bed_path, bim_path, fam_path, out_prefix, counted_allele, fixed_width, compress));
+    return rcpp_result_gen;
+END_RCPP
+}
+// eb_write_blupf90_txt_cpp
+std::string eb_write_blupf90_txt_cpp(SEXP dosage, CharacterVector sample_id, std::string path, bool fixed_width, std::string compress);
+RcppExport SEXP _easybreedeR_eb_write_blupf90_txt_cpp(SEXP dosageSEXP, SEXP sample_idSEXP, SEXP pathSEXP, SEXP fixed_widthSEXP, SEXP compressSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type dosage(dosageSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type sample_id(sample_idSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< bool >::type fixed_width(fixed_widthSEXP);
+    Rcpp::traits::input_parameter< std::string >::type compress(compressSEXP);
+    rcpp_result_gen = Rcpp::wrap(eb_write_blupf90_txt_cpp(dosage, sample_id, path, fixed_width, compress));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_encode_ped_strings
+SEXP gvr_encode_ped_strings(CharacterMatrix geno_pairs, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_encode_ped_strings(SEXP geno_pairsSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< CharacterMatrix >::type geno_pairs(geno_pairsSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_call_rate_from_ped_strings_cpp(geno_pairs));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_encode_ped_strings(geno_pairs, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// gvr_call_rate_from_ped_strings_cpp
+List gvr_call_rate_from_ped_strings_cpp(SEXP geno_pairs, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_call_rate_from_ped_strings_cpp(SEXP geno_pairsSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type geno_pairs(geno_pairsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_call_rate_from_ped_strings_cpp(geno_pairs, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_maf_from_ped_strings_cpp
-NumericVector gvr_maf_from_ped_strings_cpp(CharacterMatrix geno_pairs);
-RcppExport SEXP _easybreedeR_gvr_maf_from_ped_strings_cpp(SEXP geno_pairsSEXP) {
+NumericVector gvr_maf_from_ped_strings_cpp(SEXP geno_pairs, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_maf_from_ped_strings_cpp(SEXP geno_pairsSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< CharacterMatrix >::type geno_pairs(geno_pairsSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_maf_from_ped_strings_cpp(geno_pairs));
+    Rcpp::traits::input_parameter< SEXP >::type geno_pairs(geno_pairsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_maf_from_ped_strings_cpp(geno_pairs, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_hwe_from_ped_strings_cpp
-NumericVector gvr_hwe_from_ped_strings_cpp(CharacterMatrix geno_pairs);
-RcppExport SEXP _easybreedeR_gvr_hwe_from_ped_strings_cpp(SEXP geno_pairsSEXP) {
+NumericVector gvr_hwe_from_ped_strings_cpp(SEXP geno_pairs, int n_threads, bool midp);
+RcppExport SEXP _easybreedeR_gvr_hwe_from_ped_strings_cpp(SEXP geno_pairsSEXP, SEXP n_threadsSEXP, SEXP midpSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< CharacterMatrix >::type geno_pairs(geno_pairsSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_hwe_from_ped_strings_cpp(geno_pairs));
+    Rcpp::traits::input_parameter< SEXP >::type geno_pairs(geno_pairsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type midp(midpSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_hwe_from_ped_strings_cpp(geno_pairs, n_threads, midp));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_individual_het_from_ped_strings_cpp
-NumericVector gvr_individual_het_from_ped_strings_cpp(CharacterMatrix geno_pairs);
-RcppExport SEXP _easybreedeR_gvr_individual_het_from_ped_strings_cpp(SEXP geno_pairsSEXP) {
+NumericVector gvr_individual_het_from_ped_strings_cpp(SEXP geno_pairs, int n_threads);
+RcppExport SEXP _easybreedeR_gvr_individual_het_from_ped_strings_cpp(SEXP geno_pairsSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< CharacterMatrix >::type geno_pairs(geno_pairsSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_individual_het_from_ped_strings_cpp(geno_pairs));
+    Rcpp::traits::input_parameter< SEXP >::type geno_pairs(geno_pairsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_individual_het_from_ped_strings_cpp(geno_pairs, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // gvr_dosage_from_ped_strings_cpp
-NumericMatrix gvr_dosage_from_ped_strings_cpp(CharacterMatrix geno_pairs);
-RcppExport SEXP _easybreedeR_gvr_dosage_from_ped_strings_cpp(SEXP geno_pairsSEXP) {
+SEXP gvr_dosage_from_ped_strings_cpp(SEXP geno_pairs, int n_threads, std::string output);
+RcppExport SEXP _easybreedeR_gvr_dosage_from_ped_strings_cpp(SEXP geno_pairsSEXP, SEXP n_threadsSEXP, SEXP outputSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< CharacterMatrix >::type geno_pairs(geno_pairsSEXP);
-    rcpp_result_gen = Rcpp::wrap(gvr_dosage_from_ped_strings_cpp(geno_pairs));
+    Rcpp::traits::input_parameter< SEXP >::type geno_pairs(geno_pairsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type output(outputSEXP);
+    rcpp_result_gen = Rcpp::wrap(gvr_dosage_from_ped_strings_cpp(geno_pairs, n_threads, output));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_easybreedeR_gvr_marker_call_rate", (DL_FUNC) &_easybreedeR_gvr_marker_call_rate, 1},
-    {"_easybreedeR_gvr_individual_call_rate", (DL_FUNC) &_easybreedeR_gvr_individual_call_rate, 1},
-    {"_easybreedeR_gvr_maf", (DL_FUNC) &_easybreedeR_gvr_maf, 1},
-    {"_easybreedeR_gvr_individual_het", (DL_FUNC) &_easybreedeR_gvr_individual_het, 1},
-    {"_easybreedeR_gvr_marker_het", (DL_FUNC) &_easybreedeR_gvr_marker_het, 1},
-    {"_easybreedeR_gvr_hwe_exact", (DL_FUNC) &_easybreedeR_gvr_hwe_exact, 1},
-    {"_easybreedeR_gvr_relatedness_pairs", (DL_FUNC) &_easybreedeR_gvr_relatedness_pairs, 6},
-    {"_easybreedeR_gvr_pca_from_dosage_cpp", (DL_FUNC) &_easybreedeR_gvr_pca_from_dosage_cpp, 3},
+    {"_easybreedeR_gvr_marker_call_rate", (DL_FUNC) &_easybreedeR_gvr_marker_call_rate, 2},
+    {"_easybreedeR_gvr_individual_call_rate", (DL_FUNC) &_easybreedeR_gvr_individual_call_rate, 2},
+    {"_easybreedeR_gvr_maf", (DL_FUNC) &_easybreedeR_gvr_maf, 2},
+    {"_easybreedeR_gvr_individual_het", (DL_FUNC) &_easybreedeR_gvr_individual_het, 2},
+    {"_easybreedeR_gvr_marker_het", (DL_FUNC) &_easybreedeR_gvr_marker_het, 2},
+    {"_easybreedeR_gvr_hwe_exact", (DL_FUNC) &_easybreedeR_gvr_hwe_exact, 3},
+    {"_easybreedeR_gvr_qc_summary", (DL_FUNC) &_easybreedeR_gvr_qc_summary, 3},
+    {"_easybreedeR_gvr_relatedness_pairs", (DL_FUNC) &_easybreedeR_gvr_relatedness_pairs, 13},
+    {"_easybreedeR_gvr_read_relatedness_bin", (DL_FUNC) &_easybreedeR_gvr_read_relatedness_bin, 2},
+    {"_easybreedeR_gvr_pca_from_dosage_cpp", (DL_FUNC) &_easybreedeR_gvr_pca_from_dosage_cpp, 6},
+    {"_easybreedeR_gvr_grm", (DL_FUNC) &_easybreedeR_gvr_grm, 5},
+    {"_easybreedeR_gvr_read_grm", (DL_FUNC) &_easybreedeR_gvr_read_grm, 1},
+    {"_easybreedeR_gvr_ld_prune", (DL_FUNC) &_easybreedeR_gvr_ld_prune, 8},
+    {"_easybreedeR_gvr_qc_filter", (DL_FUNC) &_easybreedeR_gvr_qc_filter, 10},
+    {"_easybreedeR_gvr_stats_cache", (DL_FUNC) &_easybreedeR_gvr_stats_cache, 3},
+    {"_easybreedeR_gvr_stats_cache_update", (DL_FUNC) &_easybreedeR_gvr_stats_cache_update, 4},
+    {"_easybreedeR_gvr_pack_genotypes", (DL_FUNC) &_easybreedeR_gvr_pack_genotypes, 1},
+    {"_easybreedeR_gvr_pack_bed", (DL_FUNC) &_easybreedeR_gvr_pack_bed, 3},
+    {"_easybreedeR_gvr_read_plink_bfile", (DL_FUNC) &_easybreedeR_gvr_read_plink_bfile, 3},
+    {"_easybreedeR_gvr_genotype_view", (DL_FUNC) &_easybreedeR_gvr_genotype_view, 3},
+    {"_easybreedeR_gvr_packed_info", (DL_FUNC) &_easybreedeR_gvr_packed_info, 1},
+    {"_easybreedeR_gvr_unpack_genotypes", (DL_FUNC) &_easybreedeR_gvr_unpack_genotypes, 1},
     {"_easybreedeR_fast_pedigree_qc", (DL_FUNC) &_easybreedeR_fast_pedigree_qc, 3},
     {"_easybreedeR_fast_pedigree_qc_sex", (DL_FUNC) &_easybreedeR_fast_pedigree_qc_sex, 4},
     {"_easybreedeR_fast_detect_loops", (DL_FUNC) &_easybreedeR_fast_detect_loops, 3},
@@ -332,12 +618,16 @@ static const R_CallMethodDef CallEntries[] = {
     {"_easybreedeR_fast_descendant_summary", (DL_FUNC) &_easybreedeR_fast_descendant_summary, 3},
     {"_easybreedeR_fast_inbreeding_cpp", (DL_FUNC) &_easybreedeR_fast_inbreeding_cpp, 3},
     {"_easybreedeR_fast_top_contrib_cpp", (DL_FUNC) &_easybreedeR_fast_top_contrib_cpp, 7},
-    {"_easybreedeR_eb_ped_to_blup_codes_cpp", (DL_FUNC) &_easybreedeR_eb_ped_to_blup_codes_cpp, 3},
-    {"_easybreedeR_gvr_call_rate_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_call_rate_from_ped_strings_cpp, 1},
-    {"_easybreedeR_gvr_maf_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_maf_from_ped_strings_cpp, 1},
-    {"_easybreedeR_gvr_hwe_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_hwe_from_ped_strings_cpp, 1},
-    {"_easybreedeR_gvr_individual_het_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_individual_het_from_ped_strings_cpp, 1},
-    {"_easybreedeR_gvr_dosage_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_dosage_from_ped_strings_cpp, 1},
+    {"_easybreedeR_eb_ped_to_blup_codes_cpp", (DL_FUNC) &_easybreedeR_eb_ped_to_blup_codes_cpp, 5},
+    {"_easybreedeR_eb_ped_file_to_blup_codes_cpp", (DL_FUNC) &_easybreedeR_eb_ped_file_to_blup_codes_cpp, 4},
+    {"_easybreedeR_eb_bed_to_blupf90_cpp", (DL_FUNC) &_easybreedeR_eb_bed_to_blupf90_cpp, 7},
+    {"_easybreedeR_eb_write_blupf90_txt_cpp", (DL_FUNC) &_easybreedeR_eb_write_blupf90_txt_cpp, 5},
+    {"_easybreedeR_gvr_encode_ped_strings", (DL_FUNC) &_easybreedeR_gvr_encode_ped_strings, 2},
+    {"_easybreedeR_gvr_call_rate_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_call_rate_from_ped_strings_cpp, 2},
+    {"_easybreedeR_gvr_maf_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_maf_from_ped_strings_cpp, 2},
+    {"_easybreedeR_gvr_hwe_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_hwe_from_ped_strings_cpp, 3},
+    {"_easybreedeR_gvr_individual_het_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_individual_het_from_ped_strings_cpp, 2},
+    {"_easybreedeR_gvr_dosage_from_ped_strings_cpp", (DL_FUNC) &_easybreedeR_gvr_dosage_from_ped_strings_cpp, 3},
     {NULL, NULL, 0}
 };
 
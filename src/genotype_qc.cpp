@@ -1,9 +1,33 @@
+// [[Rcpp::plugins(openmp)]]
+#define USE_FC_LEN_T
 #include <Rcpp.h>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <limits>
+#include <memory>
+#include <random>
+#include <string>
 #include <vector>
 
+#include "packed_genotypes.h"
+#include "plink_bfile.h"
+#include "gvr_threads.h"
+#include "hwe_exact.h"
+#include "ibs_planes.h"
+
+#ifdef GVR_USE_BLAS
+#include <R_ext/BLAS.h>
+#endif
+#include <R_ext/Lapack.h>
+#ifndef FCONE
+#define FCONE
+#endif
+
 using namespace Rcpp;
 
 inline bool is_missing(double x) {
@@ -48,200 +72,528 @@ inline double pair_prob_z2(int g1, int g2, double p) {
   return hw_prob(g1, p);
 }
 
-// [[Rcpp::export]]
-NumericVector gvr_marker_call_rate(NumericMatrix geno) {
-  int n = geno.nrow(), m = geno.ncol();
-  NumericVector out(m, NA_REAL);
-  if (n == 0 || m == 0) return out;
-  for (int j = 0; j < m; ++j) {
-    int non_missing = 0;
-    for (int i = 0; i < n; ++i) {
+// Dosage matrix exposed through the same interface as gvr::PackedGenotypes,
+// so every kernel below is written once for both. Two layouts are read in
+// place: doubles (NA for missing) and the one-byte raw matrices produced by
+// the converters' output = "raw", where any value other than 0/1/2 (e.g.
+// gvr::RAW_DOSAGE_MISSING) is missing. Other matrix types are coerced to
+// double.
+class DosageMatrixView {
+public:
+  explicit DosageMatrixView(SEXP geno) : raw_(NULL), real_(NULL) {
+    if (TYPEOF(geno) == RAWSXP) {
+      if (!Rf_isMatrix(geno)) Rcpp::stop("geno must be a dosage matrix");
+      geno_ = geno;
+      raw_ = RAW(geno);
+    } else {
+      NumericMatrix x(geno);
+      geno_ = x;
+      real_ = x.begin();
+    }
+    n_ = Rf_nrows(geno_);
+    m_ = Rf_ncols(geno_);
+  }
+
+  int n_samples() const { return n_; }
+  int n_markers() const { return m_; }
+
+  bool dosage(int i, int j, int &out) const {
+    const size_t k = (size_t)j * (size_t)n_ + (size_t)i;
+    if (raw_) {
+      if (raw_[k] > 2) return false;
+      out = raw_[k];
+      return true;
+    }
+    return as_dosage(real_[k], out);
+  }
+
+  void count_marker(int j, gvr::GenoCounts &c) const {
+    c = gvr::GenoCounts();
+    if (raw_) {
+      const Rbyte *col = raw_ + (size_t)j * (size_t)n_;
+      int k[4] = {0, 0, 0, 0};
+      for (int i = 0; i < n_; ++i) k[col[i] > 2 ? 3 : col[i]]++;
+      c.n0 = k[0];
+      c.n1 = k[1];
+      c.n2 = k[2];
+      c.missing = k[3];
+      return;
+    }
+    const double *col = real_ + (size_t)j * (size_t)n_;
+    for (int i = 0; i < n_; ++i) {
       int d = 0;
-      if (as_dosage(geno(i, j), d)) non_missing++;
+      if (!as_dosage(col[i], d)) c.missing++;
+      else if (d == 0) c.n0++;
+      else if (d == 1) c.n1++;
+      else c.n2++;
     }
-    out[j] = (double)non_missing / (double)n;
   }
-  return out;
-}
 
-// [[Rcpp::export]]
-NumericVector gvr_individual_call_rate(NumericMatrix geno) {
-  int n = geno.nrow(), m = geno.ncol();
-  NumericVector out(n, NA_REAL);
-  if (n == 0 || m == 0) return out;
-  for (int i = 0; i < n; ++i) {
-    int non_missing = 0;
-    for (int j = 0; j < m; ++j) {
+  void decode_marker(int j, signed char *out) const {
+    if (raw_) {
+      const Rbyte *col = raw_ + (size_t)j * (size_t)n_;
+      for (int i = 0; i < n_; ++i) out[i] = col[i] > 2 ? (signed char)-1 : (signed char)col[i];
+      return;
+    }
+    const double *col = real_ + (size_t)j * (size_t)n_;
+    for (int i = 0; i < n_; ++i) {
       int d = 0;
-      if (as_dosage(geno(i, j), d)) non_missing++;
+      out[i] = as_dosage(col[i], d) ? (signed char)d : (signed char)-1;
     }
-    out[i] = (double)non_missing / (double)m;
   }
+
+private:
+  RObject geno_;
+  const Rbyte *raw_;
+  const double *real_;
+  int n_ = 0, m_ = 0;
+};
+
+// Matrix kept behind a view or cache: raw and double matrices as they are,
+// other types coerced to double once rather than on every kernel call.
+inline SEXP stored_dosage_matrix(SEXP geno) {
+  if (!Rf_isMatrix(geno)) Rcpp::stop("geno must be a dosage matrix, packed store or genotype view");
+  if (TYPEOF(geno) == RAWSXP || TYPEOF(geno) == REALSXP) return geno;
+  return NumericMatrix(geno);
+}
+
+// Optional per-marker keep mask (e.g. from gvr_ld_prune()) as 0/1 flags; an
+// empty mask keeps every marker and NA counts as dropped.
+inline std::vector<char> marker_mask(LogicalVector keep, int m) {
+  if (keep.size() == 0) return std::vector<char>(m, 1);
+  if (keep.size() != m) Rcpp::stop("marker_keep must have one entry per marker");
+  std::vector<char> out(m);
+  for (int j = 0; j < m; ++j) out[j] = keep[j] == TRUE;
   return out;
 }
 
-// [[Rcpp::export]]
-NumericVector gvr_maf(NumericMatrix geno) {
-  int n = geno.nrow(), m = geno.ncol();
-  NumericVector out(m, NA_REAL);
-  for (int j = 0; j < m; ++j) {
-    double sum_d = 0.0;
-    int cnt = 0;
-    for (int i = 0; i < n; ++i) {
+// Lazy sample/marker subset of a dosage matrix or packed store, created by
+// gvr_genotype_view(). Only the kept indices are stored; the base object is
+// held in the external pointer's protected slot, so re-filtering never copies
+// genotypes and kernels touch only the kept markers.
+const char *const GENOTYPE_VIEW_CLASS = "gvr_genotype_view";
+
+struct GenotypeMask {
+  std::vector<int> samples, markers; // ascending indices into the base
+  int base_samples = 0, base_markers = 0;
+  bool all_samples() const { return (int)samples.size() == base_samples; }
+};
+
+inline bool is_genotype_view(SEXP x) {
+  return TYPEOF(x) == EXTPTRSXP && Rf_inherits(x, GENOTYPE_VIEW_CLASS);
+}
+
+inline const GenotypeMask &genotype_mask(SEXP x) {
+  Rcpp::XPtr<GenotypeMask> ptr(x);
+  if (ptr.get() == NULL) {
+    Rcpp::stop("Genotype view is no longer valid (objects cannot be saved across sessions)");
+  }
+  return *ptr;
+}
+
+class MaskedGenotypes {
+public:
+  explicit MaskedGenotypes(SEXP view)
+    : mask_(genotype_mask(view)), packed_(NULL), dense_(NumericMatrix(0, 0)) {
+    SEXP base = R_ExternalPtrProtected(view);
+    if (gvr::is_packed_genotypes(base)) packed_ = &gvr::packed_genotypes(base);
+    else dense_ = DosageMatrixView(base);
+  }
+
+  int n_samples() const { return (int)mask_.samples.size(); }
+  int n_markers() const { return (int)mask_.markers.size(); }
+
+  bool dosage(int i, int j, int &out) const {
+    return base_dosage(mask_.samples[i], mask_.markers[j], out);
+  }
+
+  void count_marker(int j, gvr::GenoCounts &c) const {
+    const int jj = mask_.markers[j];
+    if (mask_.all_samples()) {
+      if (packed_) packed_->count_marker(jj, c);
+      else dense_.count_marker(jj, c);
+      return;
+    }
+    c = gvr::GenoCounts();
+    for (int k = 0, n = n_samples(); k < n; ++k) {
       int d = 0;
-      if (as_dosage(geno(i, j), d)) {
-        sum_d += d;
-        cnt++;
-      }
+      if (!base_dosage(mask_.samples[k], jj, d)) c.missing++;
+      else if (d == 0) c.n0++;
+      else if (d == 1) c.n1++;
+      else c.n2++;
     }
-    if (cnt > 0) {
-      double p = (sum_d / (double)cnt) / 2.0;
-      out[j] = std::min(p, 1.0 - p);
+  }
+
+  void decode_marker(int j, signed char *out) const {
+    const int jj = mask_.markers[j];
+    if (mask_.all_samples()) {
+      if (packed_) packed_->decode_marker(jj, out);
+      else dense_.decode_marker(jj, out);
+      return;
+    }
+    for (int k = 0, n = n_samples(); k < n; ++k) {
+      int d = 0;
+      out[k] = base_dosage(mask_.samples[k], jj, d) ? (signed char)d : (signed char)-1;
     }
   }
+
+private:
+  bool base_dosage(int i, int j, int &out) const {
+    return packed_ ? packed_->dosage(i, j, out) : dense_.dosage(i, j, out);
+  }
+
+  const GenotypeMask &mask_;
+  const gvr::PackedGenotypes *packed_;
+  DosageMatrixView dense_;
+};
+
+inline int n_markers_of(SEXP geno) {
+  if (is_genotype_view(geno)) return (int)genotype_mask(geno).markers.size();
+  return gvr::is_packed_genotypes(geno) ? gvr::packed_genotypes(geno).n_markers() : Rf_ncols(geno);
+}
+
+template <class Geno>
+NumericVector marker_call_rate_impl(const Geno &geno, int n_threads) {
+  int n = geno.n_samples(), m = geno.n_markers();
+  NumericVector out(m, NA_REAL);
+  if (n == 0 || m == 0) return out;
+  double *out_p = out.begin();
+  gvr::parallel_markers(m, n_threads, [&](int j, int) {
+    gvr::GenoCounts c;
+    geno.count_marker(j, c);
+    out_p[j] = (double)c.valid() / (double)n;
+  });
   return out;
 }
 
-// [[Rcpp::export]]
-NumericVector gvr_individual_het(NumericMatrix geno) {
-  int n = geno.nrow(), m = geno.ncol();
+// Per-thread integer tallies over samples, summed once all markers are done.
+class SampleTallies {
+public:
+  SampleTallies(int n_threads, int n) : n_(n), counts_((size_t)n_threads * (size_t)n, 0) {}
+  int *thread(int t) { return counts_.data() + (size_t)t * (size_t)n_; }
+  std::vector<int> total() const {
+    std::vector<int> out(n_, 0);
+    const size_t nt = n_ > 0 ? counts_.size() / (size_t)n_ : 0;
+    for (size_t t = 0; t < nt; ++t) {
+      const int *c = counts_.data() + t * (size_t)n_;
+      for (int i = 0; i < n_; ++i) out[i] += c[i];
+    }
+    return out;
+  }
+
+private:
+  int n_;
+  std::vector<int> counts_;
+};
+
+// One decode buffer per thread.
+class ColumnBuffers {
+public:
+  ColumnBuffers(int n_threads, int n) : n_(n), buf_((size_t)n_threads * (size_t)n) {}
+  signed char *thread(int t) { return buf_.data() + (size_t)t * (size_t)n_; }
+
+private:
+  int n_;
+  std::vector<signed char> buf_;
+};
+
+template <class Geno>
+NumericVector individual_call_rate_impl(const Geno &geno, int n_threads) {
+  int n = geno.n_samples(), m = geno.n_markers();
+  NumericVector out(n, NA_REAL);
+  if (n == 0 || m == 0) return out;
+  SampleTallies non_missing(n_threads, n);
+  ColumnBuffers cols(n_threads, n);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    signed char *col = cols.thread(t);
+    int *nm = non_missing.thread(t);
+    geno.decode_marker(j, col);
+    for (int i = 0; i < n; ++i) nm[i] += (col[i] >= 0);
+  });
+  std::vector<int> total = non_missing.total();
+  for (int i = 0; i < n; ++i) out[i] = (double)total[i] / (double)m;
+  return out;
+}
+
+template <class Geno>
+NumericVector maf_impl(const Geno &geno, int n_threads) {
+  int m = geno.n_markers();
+  NumericVector out(m, NA_REAL);
+  double *out_p = out.begin();
+  gvr::parallel_markers(m, n_threads, [&](int j, int) {
+    gvr::GenoCounts c;
+    geno.count_marker(j, c);
+    if (c.valid() > 0) {
+      double p = ((double)c.dosage_sum() / (double)c.valid()) / 2.0;
+      out_p[j] = std::min(p, 1.0 - p);
+    }
+  });
+  return out;
+}
+
+template <class Geno>
+NumericVector individual_het_impl(const Geno &geno, int n_threads) {
+  int n = geno.n_samples(), m = geno.n_markers();
   NumericVector out(n, NA_REAL);
   if (n == 0 || m == 0) return out;
 
   // Align with PLINK --het behavior: exclude monomorphic markers.
-  std::vector<unsigned char> polymorphic(m, 0);
-  for (int j = 0; j < m; ++j) {
-    double sum_d = 0.0;
-    int ct = 0;
+  SampleTallies valid(n_threads, n), het(n_threads, n);
+  ColumnBuffers cols(n_threads, n);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    gvr::GenoCounts c;
+    geno.count_marker(j, c);
+    if (c.valid() == 0) return;
+    double p = ((double)c.dosage_sum() / (double)c.valid()) / 2.0;
+    if (!(p > 1e-12 && p < 1.0 - 1e-12)) return;
+    signed char *col = cols.thread(t);
+    int *v = valid.thread(t);
+    int *h = het.thread(t);
+    geno.decode_marker(j, col);
     for (int i = 0; i < n; ++i) {
-      int d = 0;
-      if (as_dosage(geno(i, j), d)) {
-        sum_d += d;
-        ct++;
-      }
+      v[i] += (col[i] >= 0);
+      h[i] += (col[i] == 1);
     }
-    if (ct > 0) {
-      double p = (sum_d / (double)ct) / 2.0;
-      if (p > 1e-12 && p < 1.0 - 1e-12) polymorphic[j] = 1;
-    }
-  }
-
+  });
+  std::vector<int> valid_total = valid.total(), het_total = het.total();
   for (int i = 0; i < n; ++i) {
-    int valid = 0, het = 0;
-    for (int j = 0; j < m; ++j) {
-      if (!polymorphic[j]) continue;
-      int d = 0;
-      if (as_dosage(geno(i, j), d)) {
-        valid++;
-        if (d == 1) het++;
-      }
-    }
-    if (valid > 0) out[i] = (double)het / (double)valid;
+    if (valid_total[i] > 0) out[i] = (double)het_total[i] / (double)valid_total[i];
   }
   return out;
 }
 
+template <class Geno>
+NumericVector marker_het_impl(const Geno &geno, int n_threads) {
+  int m = geno.n_markers();
+  NumericVector out(m, NA_REAL);
+  double *out_p = out.begin();
+  gvr::parallel_markers(m, n_threads, [&](int j, int) {
+    gvr::GenoCounts c;
+    geno.count_marker(j, c);
+    if (c.valid() > 0) out_p[j] = (double)c.n1 / (double)c.valid();
+  });
+  return out;
+}
+
+// Each exported kernel accepts either a numeric dosage matrix or a packed
+// store from gvr_pack_genotypes() / gvr_pack_bed(). n_threads <= 0 defers to
+// getOption("easybreedeR.threads") (default 1); results do not depend on it.
+
+// [[Rcpp::export]]
+NumericVector gvr_marker_call_rate(SEXP geno, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  if (is_genotype_view(geno)) return marker_call_rate_impl(MaskedGenotypes(geno), n_threads);
+  if (gvr::is_packed_genotypes(geno)) return marker_call_rate_impl(gvr::packed_genotypes(geno), n_threads);
+  return marker_call_rate_impl(DosageMatrixView(geno), n_threads);
+}
+
+// [[Rcpp::export]]
+NumericVector gvr_individual_call_rate(SEXP geno, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  if (is_genotype_view(geno)) return individual_call_rate_impl(MaskedGenotypes(geno), n_threads);
+  if (gvr::is_packed_genotypes(geno)) return individual_call_rate_impl(gvr::packed_genotypes(geno), n_threads);
+  return individual_call_rate_impl(DosageMatrixView(geno), n_threads);
+}
+
+// [[Rcpp::export]]
+NumericVector gvr_maf(SEXP geno, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  if (is_genotype_view(geno)) return maf_impl(MaskedGenotypes(geno), n_threads);
+  if (gvr::is_packed_genotypes(geno)) return maf_impl(gvr::packed_genotypes(geno), n_threads);
+  return maf_impl(DosageMatrixView(geno), n_threads);
+}
+
 // [[Rcpp::export]]
-NumericVector gvr_marker_het(NumericMatrix geno) {
-  int n = geno.nrow(), m = geno.ncol();
+NumericVector gvr_individual_het(SEXP geno, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  if (is_genotype_view(geno)) return individual_het_impl(MaskedGenotypes(geno), n_threads);
+  if (gvr::is_packed_genotypes(geno)) return individual_het_impl(gvr::packed_genotypes(geno), n_threads);
+  return individual_het_impl(DosageMatrixView(geno), n_threads);
+}
+
+// [[Rcpp::export]]
+NumericVector gvr_marker_het(SEXP geno, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  if (is_genotype_view(geno)) return marker_het_impl(MaskedGenotypes(geno), n_threads);
+  if (gvr::is_packed_genotypes(geno)) return marker_het_impl(gvr::packed_genotypes(geno), n_threads);
+  return marker_het_impl(DosageMatrixView(geno), n_threads);
+}
+
+template <class Geno>
+NumericVector hwe_exact_impl(const Geno &geno, int n_threads, bool midp) {
+  int m = geno.n_markers();
   NumericVector out(m, NA_REAL);
-  for (int j = 0; j < m; ++j) {
-    int valid = 0, het = 0;
-    for (int i = 0; i < n; ++i) {
-      int d = 0;
-      if (as_dosage(geno(i, j), d)) {
-        valid++;
-        if (d == 1) het++;
+  double *out_p = out.begin();
+  std::vector<gvr::HweExact> hwe = gvr::hwe_engines(n_threads);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    gvr::GenoCounts c;
+    geno.count_marker(j, c);
+    if (c.valid() >= 1) out_p[j] = hwe[t].pvalue(c.n1, c.n0, c.n2, midp);
+  });
+  return out;
+}
+
+// [[Rcpp::export]]
+NumericVector gvr_hwe_exact(SEXP geno, int n_threads = 0, bool midp = false) {
+  n_threads = gvr::resolve_threads(n_threads);
+  if (is_genotype_view(geno)) return hwe_exact_impl(MaskedGenotypes(geno), n_threads, midp);
+  if (gvr::is_packed_genotypes(geno)) return hwe_exact_impl(gvr::packed_genotypes(geno), n_threads, midp);
+  return hwe_exact_impl(DosageMatrixView(geno), n_threads, midp);
+}
+
+// Genotype pairs of two samples, unordered, in the class order of
+// gvr::IbsPlanes::add_genotype_pairs().
+const int GENOTYPE_PAIR_CLASS[6][2] = {{0, 0}, {0, 1}, {1, 1}, {1, 2}, {2, 2}, {0, 2}};
+
+// Allele-frequency bins for the IBD EM. Markers with the same frequency share
+// a bin, so with up to IBD_MAX_FREQ_BINS distinct frequencies (complete data
+// on up to ~500 samples) the binned EM is exact. Beyond that, frequencies
+// fall into equal-width bins represented by their mean frequency.
+const int IBD_MAX_FREQ_BINS = 1024;
+
+class FrequencyBins {
+public:
+  // freq[c] for the markers listed in `markers`; bin(t) is the bin of markers[t].
+  FrequencyBins(const std::vector<double> &freq, const std::vector<int> &markers)
+    : bin_(markers.size()) {
+    std::vector<double> distinct;
+    distinct.reserve(markers.size());
+    for (int c : markers) distinct.push_back(freq[c]);
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+    if ((int)distinct.size() <= IBD_MAX_FREQ_BINS) {
+      freq_ = distinct;
+      for (size_t t = 0; t < markers.size(); ++t) {
+        bin_[t] = (int)(std::lower_bound(freq_.begin(), freq_.end(), freq[markers[t]]) - freq_.begin());
       }
+      return;
+    }
+
+    std::vector<double> sum(IBD_MAX_FREQ_BINS, 0.0);
+    std::vector<int> count(IBD_MAX_FREQ_BINS, 0), remap(IBD_MAX_FREQ_BINS, -1);
+    for (size_t t = 0; t < markers.size(); ++t) {
+      const double p = freq[markers[t]];
+      const int b = std::min(IBD_MAX_FREQ_BINS - 1, (int)(p * IBD_MAX_FREQ_BINS));
+      bin_[t] = b;
+      sum[b] += p;
+      count[b]++;
+    }
+    for (int b = 0; b < IBD_MAX_FREQ_BINS; ++b) {
+      if (count[b] == 0) continue;
+      remap[b] = (int)freq_.size();
+      freq_.push_back(sum[b] / count[b]);
     }
-    if (valid > 0) out[j] = (double)het / (double)valid;
+    for (int &b : bin_) b = remap[b];
   }
-  return out;
-}
 
-static double hwe_exact_pvalue(int obs_hets, int obs_hom1, int obs_hom2) {
-  // Exact HWE test uses the Wigginton recursion used by PLINK's Hardy-Weinberg code path.
-  int obs_homr = std::min(obs_hom1, obs_hom2);
-  int obs_homc = std::max(obs_hom1, obs_hom2);
-  int rare_copies = 2 * obs_homr + obs_hets;
-  int genotypes = obs_hets + obs_homc + obs_homr;
-  if (genotypes <= 0) return NA_REAL;
+  int size() const { return (int)freq_.size(); }
+  int bin(int t) const { return bin_[t]; }
+  double freq(int b) const { return freq_[b]; }
+
+private:
+  std::vector<int> bin_;
+  std::vector<double> freq_;
+};
+
+// Sample-pair tiles and the marker words swept per pass over a tile: the
+// planes of 2 x RELATEDNESS_TILE samples over RELATEDNESS_WORD_BLOCK words
+// (3 x 8 bytes per sample and word) stay in L2 while every pair of the tile
+// is counted.
+const int RELATEDNESS_TILE = 32;
+const size_t RELATEDNESS_WORD_BLOCK = 512;
 
-  std::vector<double> probs(rare_copies + 1, 0.0);
-  int mid = (int) std::floor((double)rare_copies * (2.0 * genotypes - rare_copies) / (2.0 * genotypes));
-  if ((rare_copies & 1) != (mid & 1)) mid++;
+// Magic bytes and record layout of the compact binary relatedness output.
+const char RELATEDNESS_BIN_MAGIC[8] = {'G', 'V', 'R', 'I', 'B', 'D', '0', '1'};
 
-  int curr_hets = mid;
-  int curr_homr = (rare_copies - mid) / 2;
-  int curr_homc = genotypes - curr_hets - curr_homr;
+struct PairHit {
+  long long row;  // position of the pair in (0,1), (0,2), ..., (1,2), ... order
+  int i, j;
+  double z0, z1, z2, pi_hat, dst, ratio;
+};
 
-  probs[mid] = 1.0;
-  double sum = probs[mid];
+// Pair a ranks ahead of b: higher PI_HAT first, ties in pair order.
+inline bool pair_hit_before(const PairHit &a, const PairHit &b) {
+  if (a.pi_hat != b.pi_hat) return a.pi_hat > b.pi_hat;
+  return a.row < b.row;
+}
+
+inline bool pair_hit_row_less(const PairHit &a, const PairHit &b) { return a.row < b.row; }
 
-  while (curr_hets > 1) {
-    double p = probs[curr_hets] * curr_hets * (curr_hets - 1.0) /
-      (4.0 * (curr_homr + 1.0) * (curr_homc + 1.0));
-    probs[curr_hets - 2] = p;
-    sum += p;
-    curr_hets -= 2;
-    curr_homr += 1;
-    curr_homc += 1;
+// Writes qualifying pairs as TSV or as the compact binary format read back by
+// gvr_read_relatedness_bin(): the 8 magic bytes, int32 sample count, then one
+// 32-byte record per pair (int32 i, int32 j, 0-based sample indices; float32
+// Z0, Z1, Z2, PI_HAT, DST, RATIO).
+class RelatednessWriter {
+public:
+  RelatednessWriter(const std::string &path, const std::string &format,
+                    const std::vector<std::string> &ids)
+    : ids_(ids), binary_(format == "bin"), fp_(NULL), written_(0) {
+    if (!binary_ && format != "tsv") Rcpp::stop("out_format must be \"tsv\" or \"bin\"");
+    fp_ = std::fopen(path.c_str(), binary_ ? "wb" : "w");
+    if (!fp_) Rcpp::stop("Cannot open output file: " + path);
+    std::setvbuf(fp_, NULL, _IOFBF, 1 << 20);
+    if (binary_) {
+      const int32_t n = (int32_t)ids_.size();
+      std::fwrite(RELATEDNESS_BIN_MAGIC, 1, sizeof(RELATEDNESS_BIN_MAGIC), fp_);
+      std::fwrite(&n, sizeof(n), 1, fp_);
+    } else {
+      std::fputs("FID1\tIID1\tFID2\tIID2\tZ0\tZ1\tZ2\tPI_HAT\tDST\tRATIO\n", fp_);
+    }
   }
 
-  curr_hets = mid;
-  curr_homr = (rare_copies - mid) / 2;
-  curr_homc = genotypes - curr_hets - curr_homr;
-  while (curr_hets <= rare_copies - 2) {
-    double p = probs[curr_hets] * 4.0 * curr_homr * curr_homc /
-      ((curr_hets + 2.0) * (curr_hets + 1.0));
-    probs[curr_hets + 2] = p;
-    sum += p;
-    curr_hets += 2;
-    curr_homr -= 1;
-    curr_homc -= 1;
+  ~RelatednessWriter() {
+    if (fp_) std::fclose(fp_);
   }
 
-  if (!(obs_hets >= 0 && obs_hets <= rare_copies)) return NA_REAL;
-  if (sum <= 0.0) return NA_REAL;
-  for (int i = 0; i <= rare_copies; ++i) probs[i] /= sum;
+  RelatednessWriter(const RelatednessWriter &) = delete;
+  RelatednessWriter &operator=(const RelatednessWriter &) = delete;
 
-  double p_obs = probs[obs_hets];
-  double p_hwe = 0.0;
-  for (int i = (rare_copies & 1); i <= rare_copies; i += 2) {
-    if (probs[i] <= p_obs + 1e-12) p_hwe += probs[i];
+  void write(const PairHit &h) {
+    if (binary_) {
+      const int32_t ij[2] = {(int32_t)h.i, (int32_t)h.j};
+      const float v[6] = {(float)h.z0, (float)h.z1, (float)h.z2,
+                          (float)h.pi_hat, (float)h.dst, (float)h.ratio};
+      std::fwrite(ij, sizeof(int32_t), 2, fp_);
+      std::fwrite(v, sizeof(float), 6, fp_);
+    } else {
+      const char *a = ids_[h.i].c_str(), *b = ids_[h.j].c_str();
+      std::fprintf(fp_, "%s\t%s\t%s\t%s\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\t", a, a, b, b,
+                   h.z0, h.z1, h.z2, h.pi_hat, h.dst);
+      if (std::isnan(h.ratio)) std::fputs("NA\n", fp_);
+      else std::fprintf(fp_, "%.6f\n", h.ratio);
+    }
+    written_++;
   }
-  if (p_hwe > 1.0) p_hwe = 1.0;
-  return p_hwe;
-}
 
-// [[Rcpp::export]]
-NumericVector gvr_hwe_exact(NumericMatrix geno) {
-  int n = geno.nrow(), m = geno.ncol();
-  NumericVector out(m, NA_REAL);
-  for (int j = 0; j < m; ++j) {
-    int hom0 = 0, het = 0, hom2 = 0, valid = 0;
-    for (int i = 0; i < n; ++i) {
-      int d = 0;
-      if (as_dosage(geno(i, j), d)) {
-        valid++;
-        if (d == 0) hom0++;
-        else if (d == 1) het++;
-        else if (d == 2) hom2++;
-      }
-    }
-    if (valid >= 1) out[j] = hwe_exact_pvalue(het, hom0, hom2);
+  void close() {
+    if (!fp_) return;
+    const bool failed = std::ferror(fp_) != 0;
+    const bool close_failed = std::fclose(fp_) != 0;
+    fp_ = NULL;
+    if (failed || close_failed) Rcpp::stop("Error writing relatedness output");
   }
-  return out;
-}
 
-// [[Rcpp::export]]
-DataFrame gvr_relatedness_pairs(NumericMatrix geno, CharacterVector sample_ids,
-                                int max_pairs = 2147483647, int max_markers = 2147483647, 
-                                int min_valid = 20, bool show_progress = true) {
+  double written() const { return written_; }
+
+private:
+  const std::vector<std::string> &ids_;
+  bool binary_;
+  std::FILE *fp_;
+  double written_;
+};
+
+template <class Geno>
+SEXP relatedness_pairs_impl(const Geno &geno, CharacterVector sample_ids,
+                            int max_pairs, int max_markers, int min_valid,
+                            double em_min_pi_hat, int n_threads,
+                            double min_pi_hat, int top_k,
+                            const std::string &out_path, const std::string &out_format,
+                            const std::vector<char> &use) {
   // PLINK-inspired IBD estimation:
   // 1) compute IBS counts and method-of-moments initializer
   // 2) refine Z0/Z1/Z2 with EM on per-locus pair likelihoods under Z states.
-  int n = geno.nrow(), m = geno.ncol();
+  int n = geno.n_samples(), m = geno.n_markers();
   if (n < 2 || m < 1) {
     return DataFrame::create(
       _["FID1"] = CharacterVector(0), _["IID1"] = CharacterVector(0),
@@ -255,139 +607,211 @@ DataFrame gvr_relatedness_pairs(NumericMatrix geno, CharacterVector sample_ids,
   int use_m = std::min(m, max_markers);
   if (min_valid < 1) min_valid = 1;
   if (min_valid > use_m) min_valid = use_m;
+  if (top_k < 0) top_k = 0;
+
+  // Without a threshold, top-k or output file every enumerated pair is a row
+  // of the result. Otherwise only qualifying pairs are kept, so memory grows
+  // with the number of hits rather than with n^2.
+  const bool has_threshold = !ISNAN(min_pi_hat);
+  const bool filtered = has_threshold || top_k > 0 || !out_path.empty();
+  std::unique_ptr<RelatednessWriter> writer;
+  std::vector<std::string> ids;
+  if (filtered) {
+    ids.resize(n);
+    for (int i = 0; i < n; ++i) {
+      ids[i] = i < sample_ids.size() ? as<std::string>(sample_ids[i]) : std::to_string(i + 1);
+    }
+    if (!out_path.empty()) writer.reset(new RelatednessWriter(out_path, out_format, ids));
+  }
 
-  NumericVector p_alt(use_m, NA_REAL), e00(use_m, NA_REAL), e10(use_m, NA_REAL), e11(use_m, NA_REAL);
+  // Monomorphic loci do not inform IBD state estimation, so only polymorphic
+  // markers enter the bit planes; locus c of the planes is marker idx[c].
+  std::vector<double> freq(use_m, -1.0);
+  gvr::parallel_markers(use_m, n_threads, [&](int c, int) {
+    gvr::GenoCounts gc;
+    geno.count_marker(c, gc);
+    if (gc.valid() > 0) freq[c] = ((double)gc.dosage_sum() / (double)gc.valid()) / 2.0;
+  });
+  std::vector<int> informative;
   for (int c = 0; c < use_m; ++c) {
-    double s = 0.0;
-    int ct = 0;
-    for (int r = 0; r < n; ++r) {
-      int d = 0;
-      if (!as_dosage(geno(r, c), d)) continue;
-      s += d;
-      ct++;
-    }
-    if (ct > 0) {
-      double p = (s / (double)ct) / 2.0;
-      if (p < 0.0) p = 0.0;
-      if (p > 1.0) p = 1.0;
-      double q = 1.0 - p;
-      p_alt[c] = p;
-      e00[c] = 2.0 * p * p * q * q;                 // E[IBS0 | Z0=1]
-      e10[c] = 4.0 * p * q * (p * p + q * q);       // E[IBS1 | Z0=1]
-      e11[c] = 2.0 * p * q;                          // E[IBS1 | Z1=1]
-    }
-  }
-
-  std::vector< std::pair<int,int> > pairs;
-  pairs.reserve(std::min((long long)max_pairs, (long long)n * (n - 1) / 2));
-  for (int i = 0; i < n - 1; ++i) {
-    for (int j = i + 1; j < n; ++j) {
-      if ((int)pairs.size() >= max_pairs) break;
-      pairs.push_back(std::make_pair(i, j));
-    }
-    if ((int)pairs.size() >= max_pairs) break;
-  }
-
-  size_t np = pairs.size();
-  CharacterVector fid1(np), iid1(np), fid2(np), iid2(np), rt(np);
-  NumericVector ez(np, NA_REAL), z0(np, NA_REAL), z1(np, NA_REAL), z2(np, NA_REAL);
-  NumericVector pi_hat(np, NA_REAL), dst(np, NA_REAL), ppc(np, NA_REAL), ratio(np, NA_REAL);
-  IntegerVector phe(np, -1);
-
-  // Progress tracking
-  int progress_step = std::max(1, (int)(np / 100));  // Update every 1%
-  int last_progress = 0;
-
-  for (size_t k = 0; k < np; ++k) {
-    // Show progress and allow user interruption
-    if (show_progress && (int)k % progress_step == 0) {
-      int current_progress = (int)((k * 100) / np);
-      if (current_progress > last_progress) {
-        Rcpp::checkUserInterrupt();  // Allow user to interrupt
-        last_progress = current_progress;
+    if (use[c] && freq[c] > 0.0 && freq[c] < 1.0) informative.push_back(c);
+  }
+  const FrequencyBins bins(freq, informative);
+  const int k_loci = (int)informative.size();
+  const int n_bins = bins.size();
+
+  // Loci are laid out bin by bin, so a pair's genotype-pair counts per bin are
+  // popcounts over one contiguous range of plane words.
+  std::vector<int> idx(k_loci);
+  std::vector<int> bin_start(n_bins + 1, 0);
+  for (int t = 0; t < k_loci; ++t) bin_start[bins.bin(t) + 1]++;
+  for (int b = 0; b < n_bins; ++b) bin_start[b + 1] += bin_start[b];
+  {
+    std::vector<int> fill(bin_start.begin(), bin_start.end() - 1);
+    for (int t = 0; t < k_loci; ++t) idx[fill[bins.bin(t)]++] = informative[t];
+  }
+  std::vector<double> e00(k_loci), e10(k_loci), e11(k_loci);
+  for (int c = 0; c < k_loci; ++c) {
+    double p = freq[idx[c]];
+    double q = 1.0 - p;
+    e00[c] = 2.0 * p * p * q * q;                 // E[IBS0 | Z0=1]
+    e10[c] = 4.0 * p * q * (p * p + q * q);       // E[IBS1 | Z0=1]
+    e11[c] = 2.0 * p * q;                          // E[IBS1 | Z1=1]
+  }
+
+  // Pair likelihoods under Z0/Z1/Z2 for every (bin, genotype-pair class).
+  std::vector<double> em_p0(n_bins * 6), em_p1(n_bins * 6), em_p2(n_bins * 6);
+  for (int b = 0; b < n_bins; ++b) {
+    for (int g = 0; g < 6; ++g) {
+      const double p = bins.freq(b);
+      em_p0[b * 6 + g] = pair_prob_z0(GENOTYPE_PAIR_CLASS[g][0], GENOTYPE_PAIR_CLASS[g][1], p);
+      em_p1[b * 6 + g] = pair_prob_z1(GENOTYPE_PAIR_CLASS[g][0], GENOTYPE_PAIR_CLASS[g][1], p);
+      em_p2[b * 6 + g] = pair_prob_z2(GENOTYPE_PAIR_CLASS[g][0], GENOTYPE_PAIR_CLASS[g][1], p);
+    }
+  }
+
+  // Planes are filled one 64-locus word at a time, so threads never share a word.
+  gvr::IbsPlanes planes(n, k_loci);
+  const size_t words = planes.words();
+  {
+    ColumnBuffers cols(n_threads, n);
+    gvr::parallel_markers((int)words, n_threads, [&](int w, int t) {
+      signed char *col = cols.thread(t);
+      const int end = std::min(k_loci, (w + 1) * 64);
+      for (int c = w * 64; c < end; ++c) {
+        geno.decode_marker(idx[c], col);
+        planes.set_marker(c, col);
       }
+    });
+  }
+
+  // Moment-estimator weights over the loci a pair shares, by inclusion-
+  // exclusion: all loci, minus those either sample misses, plus those both miss.
+  double tot_e00 = 0.0, tot_e10 = 0.0, tot_e11 = 0.0;
+  for (int c = 0; c < k_loci; ++c) {
+    tot_e00 += e00[c];
+    tot_e10 += e10[c];
+    tot_e11 += e11[c];
+  }
+  std::vector<double> miss_e00(n, 0.0), miss_e10(n, 0.0), miss_e11(n, 0.0);
+  gvr::parallel_markers(n, n_threads, [&](int i, int) {
+    const uint64_t *vi = planes.called(i);
+    gvr::IbsPlanes::for_each_marker(words, k_loci, [&](size_t w) { return ~vi[w]; }, [&](int c) {
+      miss_e00[i] += e00[c];
+      miss_e10[i] += e10[c];
+      miss_e11[i] += e11[c];
+    });
+  });
+
+  // Pairs are numbered (0,1), (0,2), ..., (1,2), ...; the first max_pairs are
+  // evaluated. Pair (i, j) is number pair_row(i, j), so no pair list is kept.
+  const long long total_pairs = (long long)n * (n - 1) / 2;
+  const long long np = std::min((long long)std::max(max_pairs, 0), total_pairs);
+  auto pair_row = [n](int i, int j) -> long long {
+    return (long long)i * (2LL * n - i - 1) / 2 + (j - i - 1);
+  };
+
+  const size_t n_rows = filtered ? 0 : (size_t)np;
+  CharacterVector fid1(n_rows), iid1(n_rows), fid2(n_rows), iid2(n_rows), rt(n_rows);
+  NumericVector ez(n_rows, NA_REAL), z0(n_rows, NA_REAL), z1(n_rows, NA_REAL), z2(n_rows, NA_REAL);
+  NumericVector pi_hat(n_rows, NA_REAL), dst(n_rows, NA_REAL), ppc(n_rows, NA_REAL), ratio(n_rows, NA_REAL);
+  IntegerVector phe(n_rows, -1);
+  double *z0_p = z0.begin(), *z1_p = z1.begin(), *z2_p = z2.begin();
+  double *pi_hat_p = pi_hat.begin(), *dst_p = dst.begin(), *ratio_p = ratio.begin();
+
+  struct Scratch {
+    std::vector<gvr::IbsCounts> counts;
+    std::vector<int> pair_counts;             // (bin, genotype-pair class) counts for EM
+    std::vector<PairHit> hits;                 // qualifying pairs of the current band (tile for top_k)
+  };
+  std::vector<Scratch> scratch(n_threads);
+  for (Scratch &sc : scratch) {
+    sc.counts.resize((size_t)RELATEDNESS_TILE * RELATEDNESS_TILE);
+    sc.pair_counts.resize((size_t)n_bins * 6);
+  }
+  // top_k: one bounded heap per sample (worst on top), shared by all threads,
+  // so at most n * top_k hits are held.
+  std::vector< std::vector<PairHit> > best(top_k > 0 ? n : 0);
+
+  auto offer_best = [&](std::vector<PairHit> &heap, const PairHit &h) {
+    if ((int)heap.size() < top_k) {
+      heap.push_back(h);
+      std::push_heap(heap.begin(), heap.end(), pair_hit_before);
+    } else if (pair_hit_before(h, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), pair_hit_before);
+      heap.back() = h;
+      std::push_heap(heap.begin(), heap.end(), pair_hit_before);
     }
-    
-    int i = pairs[k].first;
-    int j = pairs[k].second;
-    int ibs0 = 0, ibs1 = 0, ibs2 = 0, hethet = 0, loci = 0;
-    double sum_e00 = 0.0, sum_e10 = 0.0, sum_e11 = 0.0;
-    std::vector<int> gi;
-    std::vector<int> gj;
-    std::vector<double> gp;
-    gi.reserve(use_m);
-    gj.reserve(use_m);
-    gp.reserve(use_m);
-
-    for (int c = 0; c < use_m; ++c) {
-      int di = 0, dj = 0;
-      if (!as_dosage(geno(i, c), di) || !as_dosage(geno(j, c), dj)) continue;
-      if (!R_finite(e00[c]) || !R_finite(e10[c]) || !R_finite(e11[c])) continue;
-      // Monomorphic loci do not inform IBD state estimation.
-      if (p_alt[c] <= 0.0 || p_alt[c] >= 1.0) continue;
-      loci++;
+  };
+
+  auto estimate_pair = [&](int i, int j, long long row, const gvr::IbsCounts &ibs, Scratch &sc) {
+    const int loci = ibs.loci;
+    if (loci < min_valid) return;
+    const double pair_dst = ((double)ibs.ibs2 + 0.5 * (double)ibs.ibs1) / (double)loci;
+    const double pair_ratio = ibs.ibs0 > 0 ? (double)ibs.hethet / (double)ibs.ibs0 : NA_REAL;
+
+    const uint64_t *vi = planes.called(i), *vj = planes.called(j);
+    double sum_e00 = tot_e00 - miss_e00[i] - miss_e00[j];
+    double sum_e10 = tot_e10 - miss_e10[i] - miss_e10[j];
+    double sum_e11 = tot_e11 - miss_e11[i] - miss_e11[j];
+    gvr::IbsPlanes::for_each_marker(words, k_loci, [&](size_t w) { return ~(vi[w] | vj[w]); }, [&](int c) {
       sum_e00 += e00[c];
       sum_e10 += e10[c];
       sum_e11 += e11[c];
-      gi.push_back(di);
-      gj.push_back(dj);
-      gp.push_back(p_alt[c]);
-      int ad = std::abs(di - dj);
-      if (ad == 2) ibs0++;
-      else if (ad == 1) ibs1++;
-      else {
-        ibs2++;
-        if (di == 1 && dj == 1) hethet++;
-      }
+    });
+
+    // Initialize with moment estimator, then refine with EM over per-locus pair likelihoods.
+    double zz0 = (sum_e00 > 1e-12) ? ((double)ibs.ibs0 / sum_e00) : 0.0;
+    if (!R_finite(zz0) || zz0 < 0.0) zz0 = 0.0;
+    if (zz0 > 1.0) zz0 = 1.0;
+
+    double zz1 = (sum_e11 > 1e-12) ? (((double)ibs.ibs1 - zz0 * sum_e10) / sum_e11) : 0.0;
+    if (!R_finite(zz1) || zz1 < 0.0) zz1 = 0.0;
+    if (zz1 > 1.0) zz1 = 1.0;
+
+    double zz2 = 1.0 - zz0 - zz1;
+    if (!R_finite(zz2) || zz2 < 0.0) zz2 = 0.0;
+    if (zz2 > 1.0) zz2 = 1.0;
+
+    double szz = zz0 + zz1 + zz2;
+    if (szz > 1e-12) {
+      zz0 /= szz;
+      zz1 /= szz;
+      zz2 /= szz;
+    } else {
+      zz0 = 0.99;
+      zz1 = 0.01;
+      zz2 = 0.0;
     }
 
-    iid1[k] = sample_ids[i];
-    fid1[k] = sample_ids[i];
-    iid2[k] = sample_ids[j];
-    fid2[k] = sample_ids[j];
-    rt[k] = "UN";
-
-    if (loci >= min_valid) {
-      dst[k] = ((double)ibs2 + 0.5 * (double)ibs1) / (double)loci;
-      if (ibs0 > 0) ratio[k] = (double)hethet / (double)ibs0;
-
-      // Initialize with moment estimator, then refine with EM over per-locus pair likelihoods.
-      double zz0 = (sum_e00 > 1e-12) ? ((double)ibs0 / sum_e00) : 0.0;
-      if (!R_finite(zz0) || zz0 < 0.0) zz0 = 0.0;
-      if (zz0 > 1.0) zz0 = 1.0;
-
-      double zz1 = (sum_e11 > 1e-12) ? (((double)ibs1 - zz0 * sum_e10) / sum_e11) : 0.0;
-      if (!R_finite(zz1) || zz1 < 0.0) zz1 = 0.0;
-      if (zz1 > 1.0) zz1 = 1.0;
-
-      double zz2 = 1.0 - zz0 - zz1;
-      if (!R_finite(zz2) || zz2 < 0.0) zz2 = 0.0;
-      if (zz2 > 1.0) zz2 = 1.0;
-
-      double szz = zz0 + zz1 + zz2;
-      if (szz > 1e-12) {
-        zz0 /= szz;
-        zz1 /= szz;
-        zz2 /= szz;
-      } else {
-        zz0 = 0.99;
-        zz1 = 0.01;
-        zz2 = 0.0;
+    // EM cannot leave a vertex of the simplex (a zero state stays zero), so
+    // such starts are already the fixed point. Pairs whose moment PI_HAT is
+    // below em_min_pi_hat keep the moment estimate.
+    const bool at_vertex = (zz0 == 0.0) + (zz1 == 0.0) + (zz2 == 0.0) >= 2;
+    const bool refine = !at_vertex && zz2 + 0.5 * zz1 >= em_min_pi_hat;
+
+    if (refine) {
+      // EM over (frequency bin x genotype-pair class) counts: each iteration
+      // costs O(bins) instead of O(loci).
+      int *cnt = sc.pair_counts.data();
+      std::fill(sc.pair_counts.begin(), sc.pair_counts.end(), 0);
+      for (int b = 0; b < n_bins; ++b) {
+        planes.add_genotype_pairs(i, j, bin_start[b], bin_start[b + 1], cnt + b * 6);
       }
 
       const int em_max_iter = 30;
       for (int it = 0; it < em_max_iter; ++it) {
         double a0 = 0.0, a1 = 0.0, a2 = 0.0;
-        for (int t = 0; t < loci; ++t) {
-          double p = gp[t];
-          double p0 = pair_prob_z0(gi[t], gj[t], p);
-          double p1 = pair_prob_z1(gi[t], gj[t], p);
-          double p2 = pair_prob_z2(gi[t], gj[t], p);
+        for (int s = 0; s < n_bins * 6; ++s) {
+          if (cnt[s] == 0) continue;
+          double p0 = em_p0[s];
+          double p1 = em_p1[s];
+          double p2 = em_p2[s];
           double den = zz0 * p0 + zz1 * p1 + zz2 * p2;
           if (den <= 0.0 || !R_finite(den)) continue;
-          a0 += (zz0 * p0) / den;
-          a1 += (zz1 * p1) / den;
-          a2 += (zz2 * p2) / den;
+          a0 += cnt[s] * (zz0 * p0) / den;
+          a1 += cnt[s] * (zz1 * p1) / den;
+          a2 += cnt[s] * (zz2 * p2) / den;
         }
         double at = a0 + a1 + a2;
         if (at <= 1e-12 || !R_finite(at)) break;
@@ -401,11 +825,144 @@ DataFrame gvr_relatedness_pairs(NumericMatrix geno, CharacterVector sample_ids,
         zz2 = nz2;
         if (delta < 1e-8) break;
       }
+    }
+
+    const double pair_pi_hat = zz2 + 0.5 * zz1;
+    if (!filtered) {
+      const size_t k = (size_t)row;
+      dst_p[k] = pair_dst;
+      ratio_p[k] = pair_ratio;
+      z0_p[k] = zz0;
+      z1_p[k] = zz1;
+      z2_p[k] = zz2;
+      pi_hat_p[k] = pair_pi_hat;
+      return;
+    }
+    if (has_threshold && !(pair_pi_hat >= min_pi_hat)) return;
+    const PairHit h = {row, i, j, zz0, zz1, zz2, pair_pi_hat, pair_dst, pair_ratio};
+    sc.hits.push_back(h);
+  };
+
+  // Upper-triangle tiles, one band of tile rows at a time. All pairs of a band
+  // precede those of the next, so each band's hits can be sorted and flushed
+  // in pair order before moving on. Tiles are independent and every pair
+  // writes only its own row, so results do not depend on n_threads.
+  std::vector<PairHit> kept;
+  const int n_blocks = (n + RELATEDNESS_TILE - 1) / RELATEDNESS_TILE;
+  for (int bi = 0; bi < n_blocks; ++bi) {
+    const int i0 = bi * RELATEDNESS_TILE;
+    if (i0 >= n - 1 || pair_row(i0, i0 + 1) >= np) break;
+    const int i1 = std::min(n, i0 + RELATEDNESS_TILE);
+
+    gvr::parallel_tasks(n_blocks - bi, n_threads, n_blocks - bi, [&](int task, int t) {
+      Scratch &sc = scratch[t];
+      const int j0 = (bi + task) * RELATEDNESS_TILE;
+      const int j1 = std::min(n, j0 + RELATEDNESS_TILE);
+      auto in_range = [&](int i, int j) { return pair_row(i, j) < np; };
+      std::fill(sc.counts.begin(), sc.counts.end(), gvr::IbsCounts());
+
+      for (size_t w0 = 0; w0 < words; w0 += RELATEDNESS_WORD_BLOCK) {
+        const size_t w1 = std::min(words, w0 + RELATEDNESS_WORD_BLOCK);
+        for (int i = i0; i < i1; ++i) {
+          for (int j = std::max(j0, i + 1); j < j1; ++j) {
+            if (!in_range(i, j)) break;
+            planes.add_pair(i, j, w0, w1, sc.counts[(size_t)(i - i0) * RELATEDNESS_TILE + (j - j0)]);
+          }
+        }
+      }
+      for (int i = i0; i < i1; ++i) {
+        for (int j = std::max(j0, i + 1); j < j1; ++j) {
+          if (!in_range(i, j)) break;
+          estimate_pair(i, j, pair_row(i, j),
+                        sc.counts[(size_t)(i - i0) * RELATEDNESS_TILE + (j - j0)], sc);
+        }
+      }
+      if (top_k > 0) {
+        // Fold the tile's hits into the shared heaps. Heap order is a strict
+        // total order, so the kept set does not depend on merge order.
+#ifdef _OPENMP
+#pragma omp critical(gvr_relatedness_best)
+#endif
+        {
+          for (const PairHit &h : sc.hits) {
+            offer_best(best[h.i], h);
+            offer_best(best[h.j], h);
+          }
+        }
+        sc.hits.clear();
+      }
+    });
+
+    if (!filtered || top_k > 0) continue;
+    std::vector<PairHit> band;
+    for (Scratch &sc : scratch) {
+      band.insert(band.end(), sc.hits.begin(), sc.hits.end());
+      sc.hits.clear();
+    }
+    std::sort(band.begin(), band.end(), pair_hit_row_less);
+    if (writer) {
+      for (const PairHit &h : band) writer->write(h);
+    } else {
+      kept.insert(kept.end(), band.begin(), band.end());
+    }
+  }
+
+  if (top_k > 0) {
+    // A pair is kept when it is among the top_k of either of its samples.
+    for (int i = 0; i < n; ++i) {
+      kept.insert(kept.end(), best[i].begin(), best[i].end());
+      std::vector<PairHit>().swap(best[i]);
+    }
+    std::sort(kept.begin(), kept.end(), pair_hit_row_less);
+    kept.erase(std::unique(kept.begin(), kept.end(),
+                           [](const PairHit &a, const PairHit &b) { return a.row == b.row; }),
+               kept.end());
+    if (writer) {
+      for (const PairHit &h : kept) writer->write(h);
+      kept.clear();
+    }
+  }
+
+  if (writer) {
+    const double written = writer->written();
+    writer->close();
+    return wrap(written);
+  }
 
-      z0[k] = zz0;
-      z1[k] = zz1;
-      z2[k] = zz2;
-      pi_hat[k] = zz2 + 0.5 * zz1;
+  if (filtered) {
+    const size_t nk = kept.size();
+    CharacterVector f1(nk), f2(nk), r(nk);
+    NumericVector k_z0(nk), k_z1(nk), k_z2(nk), k_pi(nk), k_dst(nk), k_ratio(nk);
+    for (size_t k = 0; k < nk; ++k) {
+      const PairHit &h = kept[k];
+      f1[k] = sample_ids[h.i];
+      f2[k] = sample_ids[h.j];
+      r[k] = "UN";
+      k_z0[k] = h.z0;
+      k_z1[k] = h.z1;
+      k_z2[k] = h.z2;
+      k_pi[k] = h.pi_hat;
+      k_dst[k] = h.dst;
+      k_ratio[k] = h.ratio;
+    }
+    return DataFrame::create(
+      _["FID1"] = f1, _["IID1"] = f1,
+      _["FID2"] = f2, _["IID2"] = f2,
+      _["RT"] = r, _["EZ"] = NumericVector(nk, NA_REAL),
+      _["Z0"] = k_z0, _["Z1"] = k_z1, _["Z2"] = k_z2,
+      _["PI_HAT"] = k_pi, _["PHE"] = IntegerVector(nk, -1),
+      _["DST"] = k_dst, _["PPC"] = NumericVector(nk, NA_REAL), _["RATIO"] = k_ratio
+    );
+  }
+
+  size_t k = 0;
+  for (int i = 0; i < n - 1 && k < n_rows; ++i) {
+    for (int j = i + 1; j < n && k < n_rows; ++j, ++k) {
+      iid1[k] = sample_ids[i];
+      fid1[k] = sample_ids[i];
+      iid2[k] = sample_ids[j];
+      fid2[k] = sample_ids[j];
+      rt[k] = "UN";
     }
   }
 
@@ -419,29 +976,479 @@ DataFrame gvr_relatedness_pairs(NumericMatrix geno, CharacterVector sample_ids,
   );
 }
 
+// Single column-major sweep producing every per-marker and per-sample
+// statistic of gvr_marker_call_rate, gvr_individual_call_rate, gvr_maf,
+// gvr_marker_het, gvr_individual_het and gvr_hwe_exact, with identical values.
+// Each thread keeps its own per-sample accumulators.
+template <class Geno>
+List qc_summary_impl(const Geno &geno, int n_threads, bool hwe_midp) {
+  const int n = geno.n_samples(), m = geno.n_markers();
+  NumericVector marker_call_rate(m, NA_REAL), maf(m, NA_REAL), marker_het(m, NA_REAL), hwe_p(m, NA_REAL);
+  NumericVector individual_call_rate(n, NA_REAL), individual_het(n, NA_REAL);
+  double *mcr_p = marker_call_rate.begin(), *maf_p = maf.begin();
+  double *mhet_p = marker_het.begin(), *hwe_pp = hwe_p.begin();
+
+  SampleTallies non_missing(n_threads, n), poly_valid(n_threads, n), poly_het(n_threads, n);
+  ColumnBuffers cols(n_threads, n);
+  std::vector<gvr::HweExact> hwe = gvr::hwe_engines(n_threads);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    signed char *col = cols.thread(t);
+    int *nm = non_missing.thread(t);
+    geno.decode_marker(j, col);
+    gvr::GenoCounts c;
+    for (int i = 0; i < n; ++i) {
+      const signed char d = col[i];
+      if (d < 0) c.missing++;
+      else if (d == 0) c.n0++;
+      else if (d == 1) c.n1++;
+      else c.n2++;
+      nm[i] += (d >= 0);
+    }
+
+    const int valid = c.valid();
+    if (n > 0) mcr_p[j] = (double)valid / (double)n;
+    if (valid == 0) return;
+    double p = ((double)c.dosage_sum() / (double)valid) / 2.0;
+    maf_p[j] = std::min(p, 1.0 - p);
+    mhet_p[j] = (double)c.n1 / (double)valid;
+    hwe_pp[j] = hwe[t].pvalue(c.n1, c.n0, c.n2, hwe_midp);
+
+    // Align with PLINK --het behavior: exclude monomorphic markers.
+    if (!(p > 1e-12 && p < 1.0 - 1e-12)) return;
+    int *pv = poly_valid.thread(t);
+    int *ph = poly_het.thread(t);
+    for (int i = 0; i < n; ++i) {
+      pv[i] += (col[i] >= 0);
+      ph[i] += (col[i] == 1);
+    }
+  });
+
+  if (m > 0) {
+    std::vector<int> nm = non_missing.total(), pv = poly_valid.total(), ph = poly_het.total();
+    for (int i = 0; i < n; ++i) {
+      individual_call_rate[i] = (double)nm[i] / (double)m;
+      if (pv[i] > 0) individual_het[i] = (double)ph[i] / (double)pv[i];
+    }
+  }
+
+  return List::create(
+    _["marker_call_rate"] = marker_call_rate,
+    _["maf"] = maf,
+    _["marker_het"] = marker_het,
+    _["hwe_p"] = hwe_p,
+    _["individual_call_rate"] = individual_call_rate,
+    _["individual_het"] = individual_het
+  );
+}
+
+// [[Rcpp::export]]
+List gvr_qc_summary(SEXP geno, int n_threads = 0, bool hwe_midp = false) {
+  n_threads = gvr::resolve_threads(n_threads);
+  if (is_genotype_view(geno)) return qc_summary_impl(MaskedGenotypes(geno), n_threads, hwe_midp);
+  if (gvr::is_packed_genotypes(geno)) return qc_summary_impl(gvr::packed_genotypes(geno), n_threads, hwe_midp);
+  return qc_summary_impl(DosageMatrixView(geno), n_threads, hwe_midp);
+}
+
+// show_progress is kept for compatibility; interrupts are always checked
+// between bands of pair tiles.
+// Setting min_pi_hat and/or top_k (best pairs per sample) returns only the
+// qualifying pairs. With out_path, qualifying pairs (all pairs if no filter is
+// set) are streamed to a "tsv" or "bin" file instead and the number written
+// is returned.
+// [[Rcpp::export]]
+SEXP gvr_relatedness_pairs(SEXP geno, CharacterVector sample_ids,
+                           int max_pairs = 2147483647, int max_markers = 2147483647, 
+                           int min_valid = 20, bool show_progress = true,
+                           double em_min_pi_hat = 0.0, int n_threads = 0,
+                           double min_pi_hat = NA_REAL, int top_k = 0,
+                           std::string out_path = "", std::string out_format = "tsv",
+                           LogicalVector marker_keep = LogicalVector()) {
+  (void)show_progress;
+  n_threads = gvr::resolve_threads(n_threads);
+  const std::vector<char> use = marker_mask(marker_keep, n_markers_of(geno));
+  if (is_genotype_view(geno)) {
+    return relatedness_pairs_impl(MaskedGenotypes(geno), sample_ids,
+                                  max_pairs, max_markers, min_valid, em_min_pi_hat, n_threads,
+                                  min_pi_hat, top_k, out_path, out_format, use);
+  }
+  if (gvr::is_packed_genotypes(geno)) {
+    return relatedness_pairs_impl(gvr::packed_genotypes(geno), sample_ids,
+                                  max_pairs, max_markers, min_valid, em_min_pi_hat, n_threads,
+                                  min_pi_hat, top_k, out_path, out_format, use);
+  }
+  return relatedness_pairs_impl(DosageMatrixView(geno), sample_ids,
+                                max_pairs, max_markers, min_valid, em_min_pi_hat, n_threads,
+                                min_pi_hat, top_k, out_path, out_format, use);
+}
+
+// Reads a binary file written by gvr_relatedness_pairs(out_format = "bin")
+// back into the usual pair table. sample_ids must be the IDs passed when
+// writing.
 // [[Rcpp::export]]
-SEXP gvr_pca_from_dosage_cpp(NumericMatrix geno, int n_components = 20, int max_markers = 0) {
-  const int n = geno.nrow();
-  const int m = geno.ncol();
+DataFrame gvr_read_relatedness_bin(std::string path, CharacterVector sample_ids) {
+  std::FILE *fp = std::fopen(path.c_str(), "rb");
+  if (!fp) Rcpp::stop("Cannot open file: " + path);
+  char magic[sizeof(RELATEDNESS_BIN_MAGIC)];
+  int32_t n = 0;
+  if (std::fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      std::memcmp(magic, RELATEDNESS_BIN_MAGIC, sizeof(magic)) != 0 ||
+      std::fread(&n, sizeof(n), 1, fp) != 1) {
+    std::fclose(fp);
+    Rcpp::stop("Not a gvr relatedness binary file: " + path);
+  }
+  if (n != sample_ids.size()) {
+    std::fclose(fp);
+    Rcpp::stop("File holds " + std::to_string(n) + " samples but " +
+               std::to_string(sample_ids.size()) + " sample IDs were given");
+  }
+  std::vector<int32_t> pi, pj;
+  std::vector<float> vals;
+  int32_t ij[2];
+  float v[6];
+  while (std::fread(ij, sizeof(int32_t), 2, fp) == 2 && std::fread(v, sizeof(float), 6, fp) == 6) {
+    if (ij[0] < 0 || ij[0] >= n || ij[1] < 0 || ij[1] >= n) {
+      std::fclose(fp);
+      Rcpp::stop("Corrupt relatedness record in " + path);
+    }
+    pi.push_back(ij[0]);
+    pj.push_back(ij[1]);
+    vals.insert(vals.end(), v, v + 6);
+  }
+  std::fclose(fp);
+
+  const size_t nk = pi.size();
+  CharacterVector f1(nk), f2(nk), r(nk);
+  NumericVector z0(nk), z1(nk), z2(nk), pi_hat(nk), dst(nk), ratio(nk);
+  for (size_t k = 0; k < nk; ++k) {
+    f1[k] = sample_ids[pi[k]];
+    f2[k] = sample_ids[pj[k]];
+    r[k] = "UN";
+    const float *x = &vals[k * 6];
+    z0[k] = x[0];
+    z1[k] = x[1];
+    z2[k] = x[2];
+    pi_hat[k] = x[3];
+    dst[k] = x[4];
+    ratio[k] = std::isnan(x[5]) ? NA_REAL : (double)x[5];
+  }
+  return DataFrame::create(
+    _["FID1"] = f1, _["IID1"] = f1,
+    _["FID2"] = f2, _["IID2"] = f2,
+    _["RT"] = r, _["EZ"] = NumericVector(nk, NA_REAL),
+    _["Z0"] = z0, _["Z1"] = z1, _["Z2"] = z2,
+    _["PI_HAT"] = pi_hat, _["PHE"] = IntegerVector(nk, -1),
+    _["DST"] = dst, _["PPC"] = NumericVector(nk, NA_REAL), _["RATIO"] = ratio
+  );
+}
+
+// Chunked Gram accumulation shared by gvr_grm() and the streaming PCA.
+//
+// Markers are folded into the lower triangle of an n x n matrix
+// GRM_MARKER_CHUNK at a time, each chunk a rank-k update: by BLAS dsyrk when
+// the package is built with GVR_USE_BLAS (see Makevars), otherwise by
+// GRM_TILE x GRM_TILE sample tiles spread over threads, which sum in a fixed
+// order so results do not depend on the number of threads. Only one chunk is
+// decoded at a time, so peak memory is n^2 + n * chunk for any number of
+// markers, and a memory-mapped .bed is read once, front to back.
+const int GRM_MARKER_CHUNK = 512;
+const int GRM_TILE = 64;
+
+// Calls body(i, j) for every i >= j in [0, n), one GRM_TILE x GRM_TILE tile
+// per task; each (i, j) belongs to exactly one task.
+template <class Body>
+void for_each_lower_tile(int n, int n_threads, Body body) {
+  const int nt = (n + GRM_TILE - 1) / GRM_TILE;
+  std::vector<std::pair<int, int> > tiles;
+  for (int ti = 0; ti < nt; ++ti) {
+    for (int tj = 0; tj <= ti; ++tj) tiles.push_back(std::make_pair(ti, tj));
+  }
+  gvr::parallel_tasks((int)tiles.size(), n_threads, (int)tiles.size(), [&](int t, int) {
+    const int i0 = tiles[t].first * GRM_TILE, i1 = std::min(n, i0 + GRM_TILE);
+    const int j0 = tiles[t].second * GRM_TILE, j1 = std::min(n, j0 + GRM_TILE);
+    for (int j = j0; j < j1; ++j) {
+      for (int i = std::max(i0, j); i < i1; ++i) body(i, j);
+    }
+  });
+}
+
+// Adds, for the markers idx, z = (dosage - center[c]) * scale[c] (0 when
+// missing) into g as g[i + j * n] += sum z_i z_j for i >= j (column-major, as
+// dsyrk). When both_called is non-null it receives, in the same layout, the
+// number of those markers called in both samples.
+template <class Geno>
+void accumulate_gram(const Geno &geno, const std::vector<int> &idx, const std::vector<double> &center,
+                     const std::vector<double> &scale, int n_threads, std::vector<double> &g,
+                     std::vector<int> *both_called) {
+  const int n = geno.n_samples();
+  const int m_used = (int)idx.size();
+  g.assign((size_t)n * n, 0.0);
+  if (both_called) both_called->assign((size_t)n * n, 0);
+  if (m_used == 0) return;
+
+  const int chunk = std::min(GRM_MARKER_CHUNK, m_used);
+  const size_t chunk_words = ((size_t)chunk + 63) / 64;
+  std::vector<signed char> codes((size_t)n * chunk);
+  std::vector<double> z((size_t)n * chunk);
+  std::vector<uint64_t> called(both_called ? (size_t)n * chunk_words : 0);
+  for (int c0 = 0; c0 < m_used; c0 += chunk) {
+    const int k = std::min(chunk, m_used - c0);
+#ifdef GVR_USE_BLAS
+    // Column-major n x k block for dsyrk.
+    auto z_at = [&](int i, int c) -> double & { return z[(size_t)c * n + i]; };
+#else
+    // Sample-major rows so each pair is a contiguous dot product.
+    auto z_at = [&](int i, int c) -> double & { return z[(size_t)i * k + c]; };
+#endif
+    gvr::parallel_markers(k, n_threads, [&](int c, int) {
+      signed char *col = codes.data() + (size_t)c * n;
+      geno.decode_marker(idx[c0 + c], col);
+      const double mu = center[c0 + c], s = scale[c0 + c];
+      for (int i = 0; i < n; ++i) z_at(i, c) = col[i] >= 0 ? ((double)col[i] - mu) * s : 0.0;
+    });
+
+#ifdef GVR_USE_BLAS
+    const double one = 1.0;
+    F77_CALL(dsyrk)("L", "N", &n, &k, &one, z.data(), &n, &one, g.data(), &n FCONE FCONE);
+#else
+    for_each_lower_tile(n, n_threads, [&](int i, int j) {
+      const double *zi = z.data() + (size_t)i * k, *zj = z.data() + (size_t)j * k;
+      double acc = 0.0;
+      for (int c = 0; c < k; ++c) acc += zi[c] * zj[c];
+      g[(size_t)i + (size_t)j * n] += acc;
+    });
+#endif
+
+    if (both_called) {
+      std::fill(called.begin(), called.end(), 0);
+      for (int c = 0; c < k; ++c) {
+        const signed char *col = codes.data() + (size_t)c * n;
+        const uint64_t bit = (uint64_t)1 << (c & 63);
+        for (int i = 0; i < n; ++i) {
+          if (col[i] >= 0) called[(size_t)i * chunk_words + (c >> 6)] |= bit;
+        }
+      }
+      int *bc = both_called->data();
+      for_each_lower_tile(n, n_threads, [&](int i, int j) {
+        const uint64_t *a = called.data() + (size_t)i * chunk_words;
+        const uint64_t *b = called.data() + (size_t)j * chunk_words;
+        int cnt = 0;
+        for (size_t w = 0; w < chunk_words; ++w) cnt += gvr::popcount64(a[w] & b[w]);
+        bc[(size_t)i + (size_t)j * n] += cnt;
+      });
+    }
+    Rcpp::checkUserInterrupt();
+  }
+}
+
+// Top principal components by thick-restart block Lanczos (block Krylov
+// subspace with full reorthogonalisation and Rayleigh-Ritz; cf. Musco &
+// Musco 2015, Wu & Simon 2000). Only products with the standardised genotype
+// matrix X are needed, so K = X X' / m is never formed: each step costs
+// O(n * m * block) time, and memory is O(n * m) bytes for the dosage codes
+// plus O((n + m) * basis) doubles.
+const int PCA_MIN_OVERSAMPLE = 10;
+const int PCA_BASIS_BLOCKS = 6;
+const int PCA_MAX_STEPS = 200;
+const double PCA_TOL = 1e-8;
+const int PCA_SAMPLE_BLOCK = 64;
+
+// Eigen-decomposition of a small symmetric k x k matrix (row-major) by
+// LAPACK dsyevr. Eigenvalues are returned in descending order and the
+// eigenvectors as the matching columns of vecs.
+inline void symmetric_eigen_small(const std::vector<double> &a, int k, std::vector<double> &vals,
+                                  std::vector<double> &vecs) {
+  // a is symmetric, so its row-major layout is also the column-major one.
+  std::vector<double> v(a), w(k), z((size_t)k * k);
+  std::vector<int> isuppz(2 * (size_t)std::max(k, 1));
+  const double zero = 0.0;
+  const int none = 0;
+  int found = 0, info = 0, lwork = -1, liwork = -1, iwork_size = 0;
+  double work_size = 0.0;
+  F77_CALL(dsyevr)("V", "A", "L", &k, v.data(), &k, &zero, &zero, &none, &none, &zero, &found,
+                   w.data(), z.data(), &k, isuppz.data(), &work_size, &lwork, &iwork_size, &liwork,
+                   &info FCONE FCONE FCONE);
+  if (info != 0) Rcpp::stop("LAPACK dsyevr workspace query failed (info = " + std::to_string(info) + ")");
+  lwork = (int)work_size;
+  liwork = iwork_size;
+  std::vector<double> work(lwork);
+  std::vector<int> iwork(liwork);
+  F77_CALL(dsyevr)("V", "A", "L", &k, v.data(), &k, &zero, &zero, &none, &none, &zero, &found,
+                   w.data(), z.data(), &k, isuppz.data(), work.data(), &lwork, iwork.data(), &liwork,
+                   &info FCONE FCONE FCONE);
+  if (info != 0) Rcpp::stop("LAPACK dsyevr failed (info = " + std::to_string(info) + ")");
+
+  // dsyevr returns ascending eigenvalues and column-major eigenvectors.
+  vals.assign(k, 0.0);
+  vecs.assign((size_t)k * k, 0.0);
+  for (int c = 0; c < k; ++c) {
+    const int src = k - 1 - c;
+    vals[c] = w[src];
+    for (int r = 0; r < k; ++r) vecs[(size_t)r * k + c] = z[(size_t)src * k + r];
+  }
+}
+
+// Orthonormalises the n-vectors block[0..l) (column-major) against the first
+// d columns of basis and each other (Gram-Schmidt, applied twice). Vectors
+// that vanish because the Krylov space has become invariant are refilled
+// from rng and orthogonalised again.
+inline void orthonormalise_block(const std::vector<double> &basis, int d, std::vector<double> &block,
+                                 int n, int l, std::mt19937 &rng) {
+  auto project_out = [&](const double *u, double *x) {
+    double dot = 0.0;
+    for (int i = 0; i < n; ++i) dot += u[i] * x[i];
+    for (int i = 0; i < n; ++i) x[i] -= dot * u[i];
+  };
+  for (int c = 0; c < l; ++c) {
+    double *x = block.data() + (size_t)c * n;
+    for (int attempt = 0; attempt < 4; ++attempt) {
+      double before = 0.0;
+      for (int i = 0; i < n; ++i) before += x[i] * x[i];
+      for (int pass = 0; pass < 2; ++pass) {
+        for (int b = 0; b < d; ++b) project_out(basis.data() + (size_t)b * n, x);
+        for (int b = 0; b < c; ++b) project_out(block.data() + (size_t)b * n, x);
+      }
+      double norm = 0.0;
+      for (int i = 0; i < n; ++i) norm += x[i] * x[i];
+      if (norm > 1e-20 * before && norm > 0.0) {
+        const double inv = 1.0 / std::sqrt(norm);
+        for (int i = 0; i < n; ++i) x[i] *= inv;
+        break;
+      }
+      for (int i = 0; i < n; ++i) x[i] = (double)rng() / 4294967296.0 - 0.5;
+    }
+  }
+}
+
+// Leading k_want eigenpairs of the symmetric positive semi-definite n x n
+// operator K, given only apply_k(q, lb, kq): kq = K q for lb column-major
+// n-vectors. theta receives the eigenvalues (descending, at least k_want of
+// them) and evecs the k_want eigenvectors, column-major.
+template <class ApplyK>
+void block_lanczos_top(int n, int k_want, ApplyK apply_k, std::vector<double> &theta,
+                       std::vector<double> &evecs) {
+  const int l = std::min(n, k_want + PCA_MIN_OVERSAMPLE);
+  const int d_max = std::min(n, PCA_BASIS_BLOCKS * l);
+
+  // basis holds d orthonormal columns V and kbasis their products K V
+  // (column-major); bmat = V' K V (row-major, stride d_max).
+  std::vector<double> basis((size_t)n * d_max), kbasis((size_t)n * d_max);
+  std::vector<double> bmat((size_t)d_max * d_max, 0.0);
+  std::vector<double> block((size_t)n * l), s;
+  int d = 0;
+
+  // Fixed seed so repeated runs give the same components.
+  std::mt19937 rng(20240611u);
+  for (double &x : block) x = (double)rng() / 4294967296.0 - 0.5;
+  int lb = l;
+
+  // Ritz vector c of the current basis (kv = false) or its product with K.
+  auto ritz = [&](int c, bool kv, double *out) {
+    const std::vector<double> &src = kv ? kbasis : basis;
+    std::fill(out, out + n, 0.0);
+    for (int r = 0; r < d; ++r) {
+      const double coef = s[(size_t)r * d + c];
+      const double *col = src.data() + (size_t)r * n;
+      for (int i = 0; i < n; ++i) out[i] += coef * col[i];
+    }
+  };
+
+  for (int step = 0;; ++step) {
+    // Extend the basis by the next block and its K products.
+    orthonormalise_block(basis, d, block, n, lb, rng);
+    std::copy(block.begin(), block.begin() + (size_t)lb * n, basis.begin() + (size_t)d * n);
+    apply_k(basis.data() + (size_t)d * n, lb, kbasis.data() + (size_t)d * n);
+    for (int c = d; c < d + lb; ++c) {
+      const double *kc = kbasis.data() + (size_t)c * n;
+      for (int r = 0; r <= c; ++r) {
+        const double *vr = basis.data() + (size_t)r * n;
+        double acc = 0.0;
+        for (int i = 0; i < n; ++i) acc += vr[i] * kc[i];
+        bmat[(size_t)r * d_max + c] = acc;
+        bmat[(size_t)c * d_max + r] = acc;
+      }
+    }
+    d += lb;
+
+    // Rayleigh-Ritz on the whole basis.
+    std::vector<double> b((size_t)d * d);
+    for (int r = 0; r < d; ++r) {
+      for (int c = 0; c < d; ++c) b[(size_t)r * d + c] = bmat[(size_t)r * d_max + c];
+    }
+    symmetric_eigen_small(b, d, theta, s);
+
+    // Converged once every wanted Ritz pair has ||K v - theta v|| small
+    // relative to the leading eigenvalue.
+    bool converged = (d == n);
+    if (!converged) {
+      const double scale = std::max(std::fabs(theta[0]), 1e-300);
+      std::vector<double> v(n), kv(n);
+      converged = true;
+      for (int c = 0; c < k_want && converged; ++c) {
+        ritz(c, false, v.data());
+        ritz(c, true, kv.data());
+        double res = 0.0;
+        for (int i = 0; i < n; ++i) res += (kv[i] - theta[c] * v[i]) * (kv[i] - theta[c] * v[i]);
+        converged = std::sqrt(res) <= PCA_TOL * scale;
+      }
+    }
+    if (converged || step + 1 >= PCA_MAX_STEPS) break;
+
+    if (d + l <= d_max) {
+      // Krylov expansion: the next block is K times the last one.
+      lb = l;
+      std::copy(kbasis.begin() + (size_t)(d - lb) * n, kbasis.begin() + (size_t)d * n, block.begin());
+    } else if (d < d_max) {
+      lb = d_max - d;
+      std::copy(kbasis.begin() + (size_t)(d - lb) * n, kbasis.begin() + (size_t)d * n, block.begin());
+    } else {
+      // Thick restart: keep the leading Ritz pairs and continue from the
+      // residuals of the first l, which span the next Krylov block.
+      const int keep = std::min(std::max(l, d_max / 2), d - 1);
+      std::vector<double> nb((size_t)n * keep), nk((size_t)n * keep);
+      for (int c = 0; c < keep; ++c) {
+        ritz(c, false, nb.data() + (size_t)c * n);
+        ritz(c, true, nk.data() + (size_t)c * n);
+      }
+      lb = std::min(l, d_max - keep);
+      for (int c = 0; c < lb; ++c) {
+        const double *v = nb.data() + (size_t)c * n;
+        const double *kv = nk.data() + (size_t)c * n;
+        double *r = block.data() + (size_t)c * n;
+        for (int i = 0; i < n; ++i) r[i] = kv[i] - theta[c] * v[i];
+      }
+      std::copy(nb.begin(), nb.end(), basis.begin());
+      std::copy(nk.begin(), nk.end(), kbasis.begin());
+      std::fill(bmat.begin(), bmat.end(), 0.0);
+      for (int c = 0; c < keep; ++c) bmat[(size_t)c * d_max + c] = theta[c];
+      d = keep;
+    }
+  }
+
+  // Ritz vectors for the wanted components.
+  evecs.assign((size_t)n * k_want, 0.0);
+  for (int c = 0; c < k_want; ++c) ritz(c, false, evecs.data() + (size_t)c * n);
+
+}
+
+template <class Geno>
+SEXP pca_from_dosage_impl(const Geno &geno, int n_components, int max_markers, bool streaming,
+                          int n_threads, const std::vector<char> &use) {
+  const int n = geno.n_samples();
+  const int m = geno.n_markers();
   if (n < 2 || m < 2) return R_NilValue;
   if (n_components < 1) n_components = 1;
   // max_markers <= 0 means "use all valid markers" (PLINK-like default).
   const bool limit_markers = (max_markers > 0);
   if (limit_markers && max_markers < 2) max_markers = 2;
 
-  // Find valid markers (non-missing data)
+  std::vector<gvr::GenoCounts> counts(m);
+  gvr::parallel_markers(m, n_threads, [&](int j, int) { geno.count_marker(j, counts[j]); });
+
+  // Find valid markers (non-missing data, and kept by the mask)
   std::vector<int> valid_markers;
   valid_markers.reserve(m);
   for (int j = 0; j < m; ++j) {
-    bool has_non_missing = false;
-    for (int i = 0; i < n; ++i) {
-      int d = 0;
-      if (as_dosage(geno(i, j), d)) {
-        has_non_missing = true;
-        break;
-      }
-    }
-    if (has_non_missing) valid_markers.push_back(j);
+    if (use[j] && counts[j].valid() > 0) valid_markers.push_back(j);
   }
   if ((int)valid_markers.size() < 2) return R_NilValue;
 
@@ -460,98 +1467,126 @@ SEXP gvr_pca_from_dosage_cpp(NumericMatrix geno, int n_components = 20, int max_
   }
   if ((int)marker_idx.size() < 2) return R_NilValue;
 
-  // Calculate allele frequencies and filter monomorphic markers
+  // Filter monomorphic markers; each kept marker maps dosage 0/1/2 to its
+  // standardised value, and missing genotypes to 0 (the mean).
   const double eps = 1e-10;
   std::vector<int> keep_markers;
-  std::vector<double> p_vec;
-  std::vector<double> sd_vec;
+  std::vector<double> two_p, inv_sd, std_value;
   keep_markers.reserve(marker_idx.size());
-  p_vec.reserve(marker_idx.size());
-  sd_vec.reserve(marker_idx.size());
-
+  std_value.reserve(3 * marker_idx.size());
   for (int marker : marker_idx) {
-    double sum_d = 0.0;
-    int cnt = 0;
-    for (int i = 0; i < n; ++i) {
-      int d = 0;
-      if (as_dosage(geno(i, marker), d)) {
-        sum_d += (double)d;
-        cnt++;
-      }
-    }
-    if (cnt == 0) continue;
-    double p = (sum_d / (double)cnt) / 2.0;
+    const gvr::GenoCounts &c = counts[marker];
+    if (c.valid() == 0) continue;
+    double p = ((double)c.dosage_sum() / (double)c.valid()) / 2.0;
     if (!R_finite(p) || p <= eps || p >= (1.0 - eps)) continue;
     double sd = std::sqrt(2.0 * p * (1.0 - p));
     if (!R_finite(sd) || sd <= eps) continue;
     keep_markers.push_back(marker);
-    p_vec.push_back(p);
-    sd_vec.push_back(sd);
+    two_p.push_back(2.0 * p);
+    inv_sd.push_back(1.0 / sd);
+    for (int d = 0; d < 3; ++d) std_value.push_back(((double)d - 2.0 * p) / sd);
   }
   const int m_keep = (int)keep_markers.size();
   if (m_keep < 2) return R_NilValue;
 
-  // Standardize genotype matrix (center and scale)
-  NumericMatrix x_std(n, m_keep);
-  for (int c = 0; c < m_keep; ++c) {
-    const int marker = keep_markers[c];
-    const double center = 2.0 * p_vec[c];
-    const double scale = sd_vec[c];
-    for (int i = 0; i < n; ++i) {
-      int d = 0;
-      if (as_dosage(geno(i, marker), d)) {
-        x_std(i, c) = ((double)d - center) / scale;
-      } else {
-        x_std(i, c) = 0.0;  // Missing values set to mean (0 after centering)
+  const int k_want = std::min(n_components, n);
+  const double inv_m = 1.0 / (double)m_keep;
+  const int n_sample_blocks = (n + PCA_SAMPLE_BLOCK - 1) / PCA_SAMPLE_BLOCK;
+  std::vector<double> theta, evecs;
+
+  if (streaming) {
+    // Accumulate K = X X' / m over marker chunks, one chunk resident at a
+    // time, then iterate on K: peak memory n^2 + n * chunk for any m.
+    std::vector<double> kmat;
+    accumulate_gram(geno, keep_markers, two_p, inv_sd, n_threads, kmat, NULL);
+    for (int j = 0; j < n; ++j) {
+      for (int i = j; i < n; ++i) {
+        const double v = kmat[(size_t)i + (size_t)j * n] * inv_m;
+        kmat[(size_t)i + (size_t)j * n] = v;
+        kmat[(size_t)j + (size_t)i * n] = v;
       }
     }
-  }
+    // kq = K q, one sample block per task.
+    auto apply_k = [&](const double *q, int lb, double *kq) {
+      gvr::parallel_tasks(n_sample_blocks, n_threads, n_sample_blocks, [&](int b, int) {
+        const int i0 = b * PCA_SAMPLE_BLOCK, i1 = std::min(n, i0 + PCA_SAMPLE_BLOCK);
+        for (int i = i0; i < i1; ++i) {
+          const double *ki = kmat.data() + (size_t)i * n;
+          for (int r = 0; r < lb; ++r) {
+            const double *qr = q + (size_t)r * n;
+            double acc = 0.0;
+            for (int j = 0; j < n; ++j) acc += ki[j] * qr[j];
+            kq[(size_t)r * n + i] = acc;
+          }
+        }
+      });
+    };
+    block_lanczos_top(n, k_want, apply_k, theta, evecs);
+  } else {
+    // Dosage codes of the kept markers, one byte per genotype.
+    std::vector<signed char> codes((size_t)n * (size_t)m_keep);
+    gvr::parallel_markers(m_keep, n_threads, [&](int c, int) {
+      geno.decode_marker(keep_markers[c], codes.data() + (size_t)c * (size_t)n);
+    });
 
-  // Compute Gram matrix K = X * X' / m (PLINK-style covariance matrix)
-  std::vector<double> k_mat((size_t)n * (size_t)n, 0.0);
-  const double inv_m = 1.0 / (double)m_keep;
-  for (int j = 0; j < n; ++j) {
-    for (int i = 0; i <= j; ++i) {
-      double acc = 0.0;
-      for (int c = 0; c < m_keep; ++c) {
-        acc += x_std(i, c) * x_std(j, c);
+    const int l = std::min(n, k_want + PCA_MIN_OVERSAMPLE);
+    std::vector<double> q_rows((size_t)n * l), y_rows((size_t)n * l), w((size_t)m_keep * l);
+
+    // kq = K q for lb column-major n-vectors. Through row-major copies,
+    // w = X' q is formed one marker per task and X w / m one sample block per
+    // task, so every sum runs in a fixed order and the result does not depend
+    // on the number of threads.
+    auto apply_k = [&](const double *q, int lb, double *kq) {
+      for (int i = 0; i < n; ++i) {
+        for (int r = 0; r < lb; ++r) q_rows[(size_t)i * lb + r] = q[(size_t)r * n + i];
       }
-      const double val = acc * inv_m;
-      k_mat[(size_t)i + (size_t)j * (size_t)n] = val;
-      k_mat[(size_t)j + (size_t)i * (size_t)n] = val;
-    }
-  }
+      gvr::parallel_markers(m_keep, n_threads, [&](int c, int) {
+        const signed char *col = codes.data() + (size_t)c * (size_t)n;
+        const double *val = std_value.data() + 3 * (size_t)c;
+        double *wc = w.data() + (size_t)c * lb;
+        std::fill(wc, wc + lb, 0.0);
+        for (int i = 0; i < n; ++i) {
+          if (col[i] < 0) continue;
+          const double x = val[col[i]];
+          const double *qi = q_rows.data() + (size_t)i * lb;
+          for (int r = 0; r < lb; ++r) wc[r] += x * qi[r];
+        }
+      });
+      gvr::parallel_tasks(n_sample_blocks, n_threads, n_sample_blocks, [&](int b, int) {
+        const int i0 = b * PCA_SAMPLE_BLOCK, i1 = std::min(n, i0 + PCA_SAMPLE_BLOCK);
+        std::fill(y_rows.begin() + (size_t)i0 * lb, y_rows.begin() + (size_t)i1 * lb, 0.0);
+        for (int c = 0; c < m_keep; ++c) {
+          const signed char *col = codes.data() + (size_t)c * (size_t)n;
+          const double *val = std_value.data() + 3 * (size_t)c;
+          const double *wc = w.data() + (size_t)c * lb;
+          for (int i = i0; i < i1; ++i) {
+            if (col[i] < 0) continue;
+            const double x = val[col[i]];
+            double *yi = y_rows.data() + (size_t)i * lb;
+            for (int r = 0; r < lb; ++r) yi[r] += x * wc[r];
+          }
+        }
+      });
+      for (int i = 0; i < n; ++i) {
+        for (int r = 0; r < lb; ++r) kq[(size_t)r * n + i] = y_rows[(size_t)i * lb + r] * inv_m;
+      }
+    };
 
-  // Convert to NumericMatrix for eigenvalue decomposition using R's eigen()
-  NumericMatrix k_rcpp(n, n);
-  for (int i = 0; i < n; ++i) {
-    for (int j = 0; j < n; ++j) {
-      k_rcpp(i, j) = k_mat[(size_t)i + (size_t)j * (size_t)n];
-    }
+    block_lanczos_top(n, k_want, apply_k, theta, evecs);
   }
 
-  // Use R's eigen function via Rcpp
-  Environment base("package:base");
-  Function eigen_func = base["eigen"];
-  List eigen_result = eigen_func(k_rcpp, Named("symmetric", true), Named("only.values", false));
-  
-  NumericVector evals = eigen_result["values"];
-  NumericMatrix evecs = eigen_result["vectors"];
-
-  // LAPACK/R returns eigenvalues in descending order
   // Keep eigenvalues that are finite and >= small tolerance
   const double eval_tol = 1e-14;
   std::vector<int> keep_eval_idx;
-  keep_eval_idx.reserve(n);
-  for (int idx = 0; idx < n; ++idx) {
-    if (R_finite(evals[idx]) && evals[idx] >= -eval_tol) {
+  keep_eval_idx.reserve(k_want);
+  for (int idx = 0; idx < k_want; ++idx) {
+    if (R_finite(theta[idx]) && theta[idx] >= -eval_tol) {
       keep_eval_idx.push_back(idx);
     }
   }
   if ((int)keep_eval_idx.size() < 1) return R_NilValue;  // At least 1 eigenvalue
 
-  const int n_keep = std::min(n_components, (int)keep_eval_idx.size());
-  if (n_keep < 1) return R_NilValue;
+  const int n_keep = (int)keep_eval_idx.size();
 
   // Extract eigenvalues and calculate variance explained
   NumericVector eigenvalues(n_keep);
@@ -559,7 +1594,7 @@ SEXP gvr_pca_from_dosage_cpp(NumericMatrix geno, int n_components = 20, int max_
   NumericMatrix scores(n, n_keep);
   double eval_sum = 0.0;
   for (int k = 0; k < n_keep; ++k) {
-    double ev = evals[keep_eval_idx[k]];
+    double ev = theta[keep_eval_idx[k]];
     if (!R_finite(ev)) ev = 0.0;
     if (ev < 0.0 && ev > -1e-12) ev = 0.0;  // Clamp small negative values (numerical error) to zero
     eigenvalues[k] = ev;
@@ -568,28 +1603,26 @@ SEXP gvr_pca_from_dosage_cpp(NumericMatrix geno, int n_components = 20, int max_
   // Use total variance for normalization
   if (!R_finite(eval_sum) || eval_sum < 0.0) eval_sum = 1.0;
 
-  // Extract eigenvectors (PC scores) from R's eigen result and ensure consistent sign
+  // Ensure consistent eigenvector signs
   for (int k = 0; k < n_keep; ++k) {
-    const int col_idx = keep_eval_idx[k];
-    
+    const double *vec = evecs.data() + (size_t)keep_eval_idx[k] * n;
+
     // Find pivot element with maximum absolute value for sign consistency
     double max_abs = -1.0;
     int pivot = 0;
     for (int i = 0; i < n; ++i) {
-      double v = evecs(i, col_idx);
-      if (std::fabs(v) > max_abs) {
-        max_abs = std::fabs(v);
+      if (std::fabs(vec[i]) > max_abs) {
+        max_abs = std::fabs(vec[i]);
         pivot = i;
       }
     }
-    
+
     // Ensure pivot is positive for consistent sign across runs
     double sign = 1.0;
-    double pivot_val = evecs(pivot, col_idx);
-    if (R_finite(pivot_val) && pivot_val < 0.0) sign = -1.0;
+    if (R_finite(vec[pivot]) && vec[pivot] < 0.0) sign = -1.0;
 
     for (int i = 0; i < n; ++i) {
-      scores(i, k) = sign * evecs(i, col_idx);
+      scores(i, k) = sign * vec[i];
     }
     variance[k] = (eigenvalues[k] / eval_sum) * 100.0;
   }
@@ -600,3 +1633,887 @@ SEXP gvr_pca_from_dosage_cpp(NumericMatrix geno, int n_components = 20, int max_
     _["eigenvalues"] = eigenvalues
   );
 }
+
+// [[Rcpp::export]]
+SEXP gvr_pca_from_dosage_cpp(SEXP geno, int n_components = 20, int max_markers = 0, int n_threads = 0,
+                             bool streaming = false, LogicalVector marker_keep = LogicalVector()) {
+  n_threads = gvr::resolve_threads(n_threads);
+  const std::vector<char> use = marker_mask(marker_keep, n_markers_of(geno));
+  if (is_genotype_view(geno)) {
+    return pca_from_dosage_impl(MaskedGenotypes(geno), n_components, max_markers, streaming,
+                                n_threads, use);
+  }
+  if (gvr::is_packed_genotypes(geno)) {
+    return pca_from_dosage_impl(gvr::packed_genotypes(geno), n_components, max_markers, streaming,
+                                n_threads, use);
+  }
+  return pca_from_dosage_impl(DosageMatrixView(geno), n_components, max_markers, streaming,
+                              n_threads, use);
+}
+
+// VanRaden (2008) genomic relationship matrix G = Z Z' / (2 sum p(1 - p)),
+// where Z holds genotypes centred by 2p and missing calls are set to 0 (mean
+// imputation). Lower triangle of G is g[i + j * n] for i >= j.
+struct GrmResult {
+  std::vector<double> g;
+  int n = 0;
+  int m_used = 0;
+  // Markers called in both samples, same layout as g; only filled when some
+  // call is missing.
+  std::vector<int> both_called;
+
+  double at(int i, int j) const {
+    return i >= j ? g[(size_t)i + (size_t)j * n] : g[(size_t)j + (size_t)i * n];
+  }
+
+  int shared_markers(int i, int j) const {
+    if (both_called.empty()) return m_used;
+    return i >= j ? both_called[(size_t)i + (size_t)j * n] : both_called[(size_t)j + (size_t)i * n];
+  }
+};
+
+template <class Geno>
+void grm_impl(const Geno &geno, int n_threads, GrmResult &out) {
+  const int n = geno.n_samples();
+  const int m = geno.n_markers();
+  out.n = n;
+
+  std::vector<gvr::GenoCounts> counts(m);
+  gvr::parallel_markers(m, n_threads, [&](int j, int) { geno.count_marker(j, counts[j]); });
+  std::vector<int> idx;
+  std::vector<double> two_p;
+  double denom = 0.0;
+  bool any_missing = false;
+  for (int j = 0; j < m; ++j) {
+    const gvr::GenoCounts &c = counts[j];
+    if (c.valid() == 0) continue;
+    const double p = (double)c.dosage_sum() / (2.0 * (double)c.valid());
+    idx.push_back(j);
+    two_p.push_back(2.0 * p);
+    denom += 2.0 * p * (1.0 - p);
+    if (c.missing > 0) any_missing = true;
+  }
+  out.m_used = (int)idx.size();
+  if (denom <= 0.0) Rcpp::stop("No polymorphic markers to build the GRM from");
+
+  accumulate_gram(geno, idx, two_p, std::vector<double>(idx.size(), 1.0), n_threads, out.g,
+                  any_missing ? &out.both_called : NULL);
+  const double scale = 1.0 / denom;
+  for (int j = 0; j < n; ++j) {
+    for (int i = j; i < n; ++i) out.g[(size_t)i + (size_t)j * n] *= scale;
+  }
+}
+
+// GCTA binary GRM: <prefix>.grm.bin holds the lower triangle row by row
+// (G[0,0], G[1,0], G[1,1], ...) as float32, <prefix>.grm.N.bin the number of
+// markers called in both samples in the same order, and <prefix>.grm.id the
+// FID/IID of each row.
+inline void write_grm_gcta(const GrmResult &r, const std::vector<std::string> &ids,
+                           const std::string &prefix) {
+  const std::string bin_path = prefix + ".grm.bin", n_path = prefix + ".grm.N.bin",
+                    id_path = prefix + ".grm.id";
+  // Handles are owned so an interrupt does not leak them.
+  typedef std::unique_ptr<std::FILE, int (*)(std::FILE *)> File;
+  File fb(std::fopen(bin_path.c_str(), "wb"), std::fclose);
+  if (!fb) Rcpp::stop("Cannot open output file: " + bin_path);
+  File fn(std::fopen(n_path.c_str(), "wb"), std::fclose);
+  if (!fn) Rcpp::stop("Cannot open output file: " + n_path);
+  std::setvbuf(fb.get(), NULL, _IOFBF, 1 << 20);
+  std::setvbuf(fn.get(), NULL, _IOFBF, 1 << 20);
+  std::vector<float> gv(r.n), nv(r.n);
+  for (int i = 0; i < r.n; ++i) {
+    if ((i & 255) == 0) Rcpp::checkUserInterrupt();
+    for (int j = 0; j <= i; ++j) {
+      gv[j] = (float)r.at(i, j);
+      nv[j] = (float)r.shared_markers(i, j);
+    }
+    std::fwrite(gv.data(), sizeof(float), i + 1, fb.get());
+    std::fwrite(nv.data(), sizeof(float), i + 1, fn.get());
+  }
+  const bool failed = std::ferror(fb.get()) != 0 || std::ferror(fn.get()) != 0;
+  const bool close_failed = (std::fclose(fb.release()) != 0) | (std::fclose(fn.release()) != 0);
+  if (failed || close_failed) Rcpp::stop("Error writing GRM output");
+
+  File fi(std::fopen(id_path.c_str(), "w"), std::fclose);
+  if (!fi) Rcpp::stop("Cannot open output file: " + id_path);
+  for (int i = 0; i < r.n; ++i) std::fprintf(fi.get(), "%s\t%s\n", ids[i].c_str(), ids[i].c_str());
+  const bool id_failed = std::ferror(fi.get()) != 0;
+  if (std::fclose(fi.release()) != 0 || id_failed) Rcpp::stop("Error writing GRM output");
+}
+
+// BLUPF90 user-supplied G: one "id_i id_j value" line per lower-triangle
+// element, diagonal included.
+inline void write_grm_blupf90(const GrmResult &r, const std::vector<std::string> &ids,
+                              const std::string &path) {
+  std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::fopen(path.c_str(), "w"), std::fclose);
+  if (!file) Rcpp::stop("Cannot open output file: " + path);
+  std::FILE *fp = file.get();
+  std::setvbuf(fp, NULL, _IOFBF, 1 << 20);
+  for (int i = 0; i < r.n; ++i) {
+    if ((i & 255) == 0) Rcpp::checkUserInterrupt();
+    for (int j = 0; j <= i; ++j) {
+      std::fprintf(fp, "%s %s %.10g\n", ids[i].c_str(), ids[j].c_str(), r.at(i, j));
+    }
+  }
+  const bool failed = std::ferror(fp) != 0;
+  if (std::fclose(file.release()) != 0 || failed) Rcpp::stop("Error writing GRM output");
+}
+
+// VanRaden GRM of all samples over all called markers. With out_prefix empty
+// the full n x n matrix is returned; otherwise it is written in GCTA binary
+// format (out_format = "gcta": <prefix>.grm.bin/.grm.N.bin/.grm.id) or as a
+// BLUPF90 user file (out_format = "blupf90": <prefix>.grm.txt), and the paths
+// written are returned. Sample labels default to 1..n.
+// [[Rcpp::export]]
+SEXP gvr_grm(SEXP geno, CharacterVector sample_ids = CharacterVector(), std::string out_prefix = "",
+             std::string out_format = "gcta", int n_threads = 0) {
+  if (!out_prefix.empty() && out_format != "gcta" && out_format != "blupf90") {
+    Rcpp::stop("out_format must be \"gcta\" or \"blupf90\"");
+  }
+  n_threads = gvr::resolve_threads(n_threads);
+  GrmResult r;
+  if (is_genotype_view(geno)) grm_impl(MaskedGenotypes(geno), n_threads, r);
+  else if (gvr::is_packed_genotypes(geno)) grm_impl(gvr::packed_genotypes(geno), n_threads, r);
+  else grm_impl(DosageMatrixView(geno), n_threads, r);
+  const int n = r.n;
+  if (sample_ids.size() != 0 && sample_ids.size() != n) {
+    Rcpp::stop("sample_ids must have one entry per sample");
+  }
+
+  if (out_prefix.empty()) {
+    NumericMatrix out(n, n);
+    for (int j = 0; j < n; ++j) {
+      for (int i = j; i < n; ++i) {
+        const double v = r.g[(size_t)i + (size_t)j * n];
+        out(i, j) = v;
+        out(j, i) = v;
+      }
+    }
+    if (sample_ids.size() == n) out.attr("dimnames") = List::create(sample_ids, sample_ids);
+    return out;
+  }
+
+  std::vector<std::string> ids(n);
+  for (int i = 0; i < n; ++i) {
+    ids[i] = sample_ids.size() == n ? as<std::string>(sample_ids[i]) : std::to_string(i + 1);
+  }
+  if (out_format == "gcta") {
+    write_grm_gcta(r, ids, out_prefix);
+    return CharacterVector::create(out_prefix + ".grm.bin", out_prefix + ".grm.N.bin",
+                                   out_prefix + ".grm.id");
+  }
+  write_grm_blupf90(r, ids, out_prefix + ".grm.txt");
+  return CharacterVector::create(out_prefix + ".grm.txt");
+}
+
+// Memory-maps a GCTA binary GRM (<prefix>.grm.bin with its .grm.id) and
+// returns the full symmetric matrix, named by IID.
+// [[Rcpp::export]]
+NumericMatrix gvr_read_grm(std::string prefix) {
+  const std::string id_path = prefix + ".grm.id", bin_path = prefix + ".grm.bin";
+  std::ifstream in(id_path.c_str());
+  if (!in) Rcpp::stop("Cannot open file: " + id_path);
+  std::vector<std::string> iid, f;
+  std::string line;
+  while (std::getline(in, line)) {
+    const int nf = gvr::split_fields(line, f);
+    if (nf == 0) continue;
+    iid.push_back(nf >= 2 ? f[1] : f[0]);
+  }
+  const int n = (int)iid.size();
+  gvr::MappedFile file(bin_path);
+  const size_t expected = (size_t)n * ((size_t)n + 1) / 2 * sizeof(float);
+  if (file.size() != expected) {
+    Rcpp::stop("GRM file " + bin_path + " has " + std::to_string(file.size()) + " bytes; expected " +
+               std::to_string(expected) + " for " + std::to_string(n) + " samples");
+  }
+  NumericMatrix out(n, n);
+  const unsigned char *p = file.data();
+  size_t k = 0;
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j <= i; ++j, ++k) {
+      float v;
+      std::memcpy(&v, p + k * sizeof(float), sizeof(float));
+      out(i, j) = v;
+      out(j, i) = v;
+    }
+  }
+  CharacterVector names = wrap(iid);
+  out.attr("dimnames") = List::create(names, names);
+  return out;
+}
+
+// LD pruning in the style of PLINK --indep-pairwise.
+//
+// Within each chromosome a window of `window` markers (or of window_bp base
+// pairs) slides forward by `step` markers. Whenever two remaining markers in
+// the window have r^2 above the threshold, the one with the lower MAF is
+// dropped. Pairs of markers that were both in the previous window have
+// already been resolved, so only pairs involving newly entered markers are
+// tested. r^2 is the squared genotype correlation over samples called at
+// both markers, computed with popcounts over per-marker bit planes: V
+// (called), O (at least one counted allele) and T (two copies), so that with
+// x = o + t and x^2 = o + 3t every sum is a popcount of ANDed words.
+// Chromosomes are independent and run in parallel.
+class LdWindowPlanes {
+public:
+  LdWindowPlanes(int n_samples, int slots)
+    : n_(n_samples), words_(((size_t)n_samples + 63) / 64), slots_(slots),
+      bits_((size_t)slots * 3 * words_), col_(n_samples) {}
+
+  template <class Geno>
+  void load(const Geno &geno, int marker, int slot) {
+    uint64_t *v = plane(slot);
+    std::fill(v, v + 3 * words_, 0);
+    geno.decode_marker(marker, col_.data());
+    for (int i = 0; i < n_; ++i) {
+      const signed char d = col_[i];
+      if (d < 0) continue;
+      const uint64_t bit = (uint64_t)1 << (i & 63);
+      const size_t w = (size_t)i >> 6;
+      v[w] |= bit;
+      if (d >= 1) v[words_ + w] |= bit;
+      if (d == 2) v[2 * words_ + w] |= bit;
+    }
+  }
+
+  double r2(int slot_a, int slot_b) const {
+    const uint64_t *va = plane(slot_a), *oa = va + words_, *ta = oa + words_;
+    const uint64_t *vb = plane(slot_b), *ob = vb + words_, *tb = ob + words_;
+    int64_t nn = 0, sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+    for (size_t w = 0; w < words_; ++w) {
+      nn += gvr::popcount64(va[w] & vb[w]);
+      const int oa_b = gvr::popcount64(oa[w] & vb[w]), ta_b = gvr::popcount64(ta[w] & vb[w]);
+      const int ob_a = gvr::popcount64(ob[w] & va[w]), tb_a = gvr::popcount64(tb[w] & va[w]);
+      sa += oa_b + ta_b;
+      saa += oa_b + 3 * ta_b;
+      sb += ob_a + tb_a;
+      sbb += ob_a + 3 * tb_a;
+      sab += gvr::popcount64(oa[w] & ob[w]) + gvr::popcount64(oa[w] & tb[w]) +
+             gvr::popcount64(ta[w] & ob[w]) + gvr::popcount64(ta[w] & tb[w]);
+    }
+    if (nn < 2) return 0.0;
+    const double n = (double)nn;
+    const double cov = (double)sab * n - (double)sa * (double)sb;
+    const double var_a = (double)saa * n - (double)sa * (double)sa;
+    const double var_b = (double)sbb * n - (double)sb * (double)sb;
+    if (var_a <= 0.0 || var_b <= 0.0) return 0.0;
+    return cov / var_a * (cov / var_b);
+  }
+
+  int slots() const { return slots_; }
+
+private:
+  uint64_t *plane(int slot) { return bits_.data() + (size_t)slot * 3 * words_; }
+  const uint64_t *plane(int slot) const { return bits_.data() + (size_t)slot * 3 * words_; }
+
+  int n_;
+  size_t words_;
+  int slots_;
+  std::vector<uint64_t> bits_;
+  std::vector<signed char> col_;
+};
+
+template <class Geno>
+LogicalVector ld_prune_impl(const Geno &geno, const std::vector<int> &chr_start, const double *bp,
+                            int window, int step, double r2_threshold, double window_bp,
+                            int n_threads) {
+  const int m = geno.n_markers();
+  std::vector<double> maf(m, -1.0);
+  gvr::parallel_markers(m, n_threads, [&](int j, int) {
+    gvr::GenoCounts c;
+    geno.count_marker(j, c);
+    if (c.valid() == 0) return;
+    const double p = (double)c.dosage_sum() / (2.0 * (double)c.valid());
+    maf[j] = std::min(p, 1.0 - p);
+  });
+
+  // Monomorphic and uncalled markers carry no LD information and are dropped.
+  std::vector<int> keep(m, 0);
+  for (int j = 0; j < m; ++j) keep[j] = maf[j] > 0.0 ? 1 : 0;
+
+  const int n_chr = (int)chr_start.size() - 1;
+  auto window_end = [&](int c1, int s) {
+    if (window_bp > 0.0) {
+      int e = s + 1;
+      while (e < c1 && bp[e] - bp[s] <= window_bp) ++e;
+      return e;
+    }
+    return std::min(c1, s + window);
+  };
+
+  std::vector<std::unique_ptr<LdWindowPlanes> > planes(n_threads);
+  gvr::parallel_tasks(n_chr, n_threads, n_chr, [&](int k, int t) {
+    const int c0 = chr_start[k], c1 = chr_start[k + 1];
+    if (c1 - c0 < 2) return;
+    int slots = 1;
+    for (int s = c0; s < c1; s += step) {
+      const int e = window_end(c1, s);
+      slots = std::max(slots, e - s);
+      if (e == c1) break;
+    }
+    if (!planes[t] || planes[t]->slots() < slots) {
+      planes[t].reset(new LdWindowPlanes(geno.n_samples(), slots));
+    }
+    LdWindowPlanes &pl = *planes[t];
+    const int cap = pl.slots();
+
+    int loaded = c0, prev_end = c0;
+    for (int s = c0; s < c1; s += step) {
+      const int e = window_end(c1, s);
+      for (; loaded < e; ++loaded) {
+        if (keep[loaded]) pl.load(geno, loaded, (loaded - c0) % cap);
+      }
+      for (int i = s; i < e; ++i) {
+        if (!keep[i]) continue;
+        for (int j = std::max(i + 1, prev_end); j < e; ++j) {
+          if (!keep[j]) continue;
+          if (pl.r2((i - c0) % cap, (j - c0) % cap) <= r2_threshold) continue;
+          if (maf[i] < maf[j]) {
+            keep[i] = 0;
+            break;
+          }
+          keep[j] = 0;
+        }
+      }
+      prev_end = e;
+      if (e == c1) break;
+    }
+  });
+
+  LogicalVector out(m);
+  for (int j = 0; j < m; ++j) out[j] = keep[j] != 0;
+  return out;
+}
+
+// Returns a keep mask over markers after LD pruning (PLINK --indep-pairwise
+// window step r2). chr labels group markers into chromosomes (consecutive
+// runs of one label; empty treats all markers as one). With window_bp > 0 the
+// window spans window_bp base pairs of the positions in bp instead of
+// `window` markers.
+// [[Rcpp::export]]
+LogicalVector gvr_ld_prune(SEXP geno, CharacterVector chr = CharacterVector(),
+                           NumericVector bp = NumericVector(), int window = 50, int step = 5,
+                           double r2_threshold = 0.2, double window_bp = 0.0, int n_threads = 0) {
+  const int m = n_markers_of(geno);
+  if (chr.size() != 0 && chr.size() != m) stop("chr must have one entry per marker");
+  if (window_bp > 0.0 && bp.size() != m) stop("bp must have one entry per marker when window_bp > 0");
+  if (window < 2 && window_bp <= 0.0) stop("window must be at least 2 markers");
+  if (step < 1) stop("step must be at least 1");
+  n_threads = gvr::resolve_threads(n_threads);
+
+  std::vector<int> chr_start(1, 0);
+  for (int j = 1; j < m; ++j) {
+    if (chr.size() != 0 && STRING_ELT(chr, j) != STRING_ELT(chr, j - 1)) chr_start.push_back(j);
+  }
+  chr_start.push_back(m);
+  const double *bp_p = bp.size() == m ? bp.begin() : NULL;
+
+  if (is_genotype_view(geno)) {
+    return ld_prune_impl(MaskedGenotypes(geno), chr_start, bp_p, window, step, r2_threshold,
+                         window_bp, n_threads);
+  }
+  if (gvr::is_packed_genotypes(geno)) {
+    return ld_prune_impl(gvr::packed_genotypes(geno), chr_start, bp_p, window, step, r2_threshold,
+                         window_bp, n_threads);
+  }
+  return ld_prune_impl(DosageMatrixView(geno), chr_start, bp_p, window, step, r2_threshold,
+                       window_bp, n_threads);
+}
+
+// Sequential sample/marker filters in PLINK's order (--geno, --mind, --maf,
+// --hwe). Each step sees only the samples and markers that survived the
+// steps before it, as chained plink runs do.
+struct QcFilterResult {
+  std::vector<char> sample_keep, marker_keep;
+  int geno_removed = 0, mind_removed = 0, maf_removed = 0, hwe_removed = 0;
+};
+
+// Tallies marker j over the kept samples. With every sample kept the packed
+// counts are used directly and nothing is decoded.
+template <class Geno>
+inline void count_kept_samples(const Geno &geno, int j, const std::vector<char> &sample_keep,
+                               bool all_samples, signed char *col, gvr::GenoCounts &c) {
+  if (all_samples) {
+    geno.count_marker(j, c);
+    return;
+  }
+  geno.decode_marker(j, col);
+  c = gvr::GenoCounts();
+  const int n = geno.n_samples();
+  for (int i = 0; i < n; ++i) {
+    if (!sample_keep[i]) continue;
+    switch (col[i]) {
+      case 0: ++c.n0; break;
+      case 1: ++c.n1; break;
+      case 2: ++c.n2; break;
+      default: ++c.missing;
+    }
+  }
+}
+
+// Clears marker_keep[j] for kept markers where drop(counts, thread) holds
+// and returns how many were dropped.
+template <class Geno, class Drop>
+int drop_markers(const Geno &geno, QcFilterResult &r, int n_threads, ColumnBuffers &cols, Drop drop) {
+  const int m = geno.n_markers();
+  const bool all_samples = std::find(r.sample_keep.begin(), r.sample_keep.end(), 0) == r.sample_keep.end();
+  std::vector<char> dropped(m, 0);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    if (!r.marker_keep[j]) return;
+    gvr::GenoCounts c;
+    count_kept_samples(geno, j, r.sample_keep, all_samples, cols.thread(t), c);
+    dropped[j] = drop(c, t) ? 1 : 0;
+  });
+  int removed = 0;
+  for (int j = 0; j < m; ++j) {
+    if (!dropped[j]) continue;
+    r.marker_keep[j] = 0;
+    ++removed;
+  }
+  return removed;
+}
+
+template <class Geno>
+QcFilterResult qc_filter_impl(const Geno &geno, double geno_threshold, double mind_threshold,
+                              double maf_threshold, double hwe_threshold, bool hwe_midp, int n_threads) {
+  const int n = geno.n_samples(), m = geno.n_markers();
+  QcFilterResult r;
+  r.sample_keep.assign(n, 1);
+  r.marker_keep.assign(m, 1);
+  ColumnBuffers cols(n_threads, n);
+
+  if (!ISNAN(geno_threshold)) {
+    r.geno_removed = drop_markers(geno, r, n_threads, cols, [&](const gvr::GenoCounts &c, int) {
+      const int total = c.valid() + c.missing;
+      return total > 0 && (double)c.missing / (double)total > geno_threshold;
+    });
+  }
+
+  if (!ISNAN(mind_threshold)) {
+    SampleTallies missing(n_threads, n);
+    gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+      if (!r.marker_keep[j]) return;
+      signed char *col = cols.thread(t);
+      int *miss = missing.thread(t);
+      geno.decode_marker(j, col);
+      for (int i = 0; i < n; ++i) miss[i] += (col[i] < 0);
+    });
+    const int m_kept = (int)std::count(r.marker_keep.begin(), r.marker_keep.end(), 1);
+    const std::vector<int> total = missing.total();
+    for (int i = 0; i < n && m_kept > 0; ++i) {
+      if ((double)total[i] / (double)m_kept > mind_threshold) {
+        r.sample_keep[i] = 0;
+        ++r.mind_removed;
+      }
+    }
+  }
+
+  if (!ISNAN(maf_threshold)) {
+    // Markers with no called genotype have no allele frequency and are dropped.
+    r.maf_removed = drop_markers(geno, r, n_threads, cols, [&](const gvr::GenoCounts &c, int) {
+      if (c.valid() == 0) return true;
+      const double p = ((double)c.dosage_sum() / (double)c.valid()) / 2.0;
+      return std::min(p, 1.0 - p) < maf_threshold;
+    });
+  }
+
+  if (!ISNAN(hwe_threshold)) {
+    std::vector<gvr::HweExact> hwe = gvr::hwe_engines(n_threads);
+    r.hwe_removed = drop_markers(geno, r, n_threads, cols, [&](const gvr::GenoCounts &c, int t) {
+      if (c.valid() == 0) return false;
+      const double p = hwe[t].pvalue(c.n1, c.n0, c.n2, hwe_midp);
+      return !ISNAN(p) && p < hwe_threshold;
+    });
+  }
+  return r;
+}
+
+// Writes the kept samples x kept markers of geno as a SNP-major .bed file.
+template <class Geno>
+void write_bed_subset(const Geno &geno, const std::vector<char> &sample_keep,
+                      const std::vector<char> &marker_keep, const std::string &path) {
+  const int n = geno.n_samples(), m = geno.n_markers();
+  const int n_out = (int)std::count(sample_keep.begin(), sample_keep.end(), 1);
+  std::vector<signed char> col(n);
+  std::vector<unsigned char> packed(gvr::packed_bytes_per_marker(n_out));
+  // Owned so the file is closed however we leave (an interrupt unwinds out
+  // of the marker loop), letting callers remove a partial output.
+  std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::fopen(path.c_str(), "wb"), std::fclose);
+  if (!file) Rcpp::stop("Cannot open output file: " + path);
+  std::FILE *fp = file.get();
+  std::setvbuf(fp, NULL, _IOFBF, 1 << 20);
+  const unsigned char magic[3] = {0x6c, 0x1b, 0x01};
+  std::fwrite(magic, 1, 3, fp);
+  for (int j = 0; j < m; ++j) {
+    if ((j & 1023) == 0) Rcpp::checkUserInterrupt();
+    if (!marker_keep[j]) continue;
+    geno.decode_marker(j, col.data());
+    std::fill(packed.begin(), packed.end(), 0);
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+      if (!sample_keep[i]) continue;
+      packed[k >> 2] |= (unsigned char)(gvr::dosage_to_code(col[i]) << ((k & 3) * 2));
+      ++k;
+    }
+    std::fwrite(packed.data(), 1, packed.size(), fp);
+  }
+  const bool bad = std::ferror(fp) != 0;
+  if (std::fclose(file.release()) != 0 || bad) Rcpp::stop("Error writing file: " + path);
+}
+
+// Applies --geno, --mind, --maf and --hwe thresholds in PLINK's order and
+// returns sample/marker keep masks with per-step removal counts. A threshold
+// left NA skips its step. With out_prefix the filtered fileset is written
+// once: the .bed is re-encoded and the kept lines of bim_path/fam_path are
+// copied verbatim.
+// [[Rcpp::export]]
+List gvr_qc_filter(SEXP geno, double geno_threshold = NA_REAL, double mind_threshold = NA_REAL,
+                   double maf_threshold = NA_REAL, double hwe_threshold = NA_REAL,
+                   bool hwe_midp = false, std::string out_prefix = "", std::string bim_path = "",
+                   std::string fam_path = "", int n_threads = 0) {
+  if (!out_prefix.empty() && (bim_path.empty() || fam_path.empty())) {
+    stop("bim_path and fam_path are required when out_prefix is set");
+  }
+  n_threads = gvr::resolve_threads(n_threads);
+  const bool view = is_genotype_view(geno), packed = gvr::is_packed_genotypes(geno);
+  QcFilterResult r;
+  if (view) {
+    r = qc_filter_impl(MaskedGenotypes(geno), geno_threshold, mind_threshold, maf_threshold,
+                       hwe_threshold, hwe_midp, n_threads);
+  } else if (packed) {
+    r = qc_filter_impl(gvr::packed_genotypes(geno), geno_threshold, mind_threshold, maf_threshold,
+                       hwe_threshold, hwe_midp, n_threads);
+  } else {
+    r = qc_filter_impl(DosageMatrixView(geno), geno_threshold, mind_threshold, maf_threshold,
+                       hwe_threshold, hwe_midp, n_threads);
+  }
+
+  CharacterVector files;
+  if (!out_prefix.empty()) {
+    const std::string bed_out = out_prefix + ".bed", bim_out = out_prefix + ".bim",
+                      fam_out = out_prefix + ".fam";
+    std::vector<char> bim_keep = r.marker_keep, fam_keep = r.sample_keep;
+    if (view) {
+      // bim_path/fam_path describe the base fileset: map kept rows back to it.
+      const GenotypeMask &mask = genotype_mask(geno);
+      bim_keep.assign(mask.base_markers, 0);
+      fam_keep.assign(mask.base_samples, 0);
+      for (size_t j = 0; j < mask.markers.size(); ++j) bim_keep[mask.markers[j]] = r.marker_keep[j];
+      for (size_t i = 0; i < mask.samples.size(); ++i) fam_keep[mask.samples[i]] = r.sample_keep[i];
+      write_bed_subset(MaskedGenotypes(geno), r.sample_keep, r.marker_keep, bed_out);
+    } else if (packed) {
+      write_bed_subset(gvr::packed_genotypes(geno), r.sample_keep, r.marker_keep, bed_out);
+    } else {
+      write_bed_subset(DosageMatrixView(geno), r.sample_keep, r.marker_keep, bed_out);
+    }
+    gvr::copy_kept_lines(bim_path, bim_out, bim_keep);
+    gvr::copy_kept_lines(fam_path, fam_out, fam_keep);
+    files = CharacterVector::create(bed_out, bim_out, fam_out);
+  }
+
+  LogicalVector sample_keep(r.sample_keep.size()), marker_keep(r.marker_keep.size());
+  for (size_t i = 0; i < r.sample_keep.size(); ++i) sample_keep[i] = r.sample_keep[i] != 0;
+  for (size_t j = 0; j < r.marker_keep.size(); ++j) marker_keep[j] = r.marker_keep[j] != 0;
+  return List::create(
+    _["sample_keep"] = sample_keep,
+    _["marker_keep"] = marker_keep,
+    _["geno_removed_snps"] = r.geno_removed,
+    _["mind_removed_samples"] = r.mind_removed,
+    _["maf_removed_snps"] = r.maf_removed,
+    _["hwe_removed_snps"] = r.hwe_removed,
+    _["files"] = files
+  );
+}
+
+// Per-marker genotype counts over a changeable set of active samples, so that
+// marker statistics can be refreshed after samples are excluded or restored
+// without rescanning the panel. The genotypes live in the protected slot of
+// the cache's external pointer; an update visits only the samples whose flag
+// changed, adding or subtracting their genotypes from every marker's counts.
+const char *const STATS_CACHE_CLASS = "gvr_stats_cache";
+
+// Past this fraction of changed samples, recounting a marker over the active
+// samples is cheaper than one lookup per changed sample.
+const double STATS_CACHE_RECOUNT_FRACTION = 0.125;
+
+struct MarkerStatsCache {
+  std::vector<gvr::GenoCounts> counts;
+  std::vector<char> active;
+};
+
+inline MarkerStatsCache &stats_cache(SEXP x) {
+  if (TYPEOF(x) != EXTPTRSXP || !Rf_inherits(x, STATS_CACHE_CLASS)) stop("Expected a gvr_stats_cache object");
+  Rcpp::XPtr<MarkerStatsCache> ptr(x);
+  if (ptr.get() == NULL) {
+    stop("Statistics cache is no longer valid (objects cannot be saved across sessions)");
+  }
+  return *ptr;
+}
+
+template <class Geno>
+inline void shift_counts(const Geno &geno, int i, int j, int delta, gvr::GenoCounts &c) {
+  int d = 0;
+  if (!geno.dosage(i, j, d)) c.missing += delta;
+  else if (d == 0) c.n0 += delta;
+  else if (d == 1) c.n1 += delta;
+  else c.n2 += delta;
+}
+
+// Moves the cache to the active set `next`; returns how many samples changed.
+template <class Geno>
+int stats_cache_update_impl(const Geno &geno, MarkerStatsCache &cache, const std::vector<char> &next,
+                            int n_threads) {
+  const int n = geno.n_samples(), m = geno.n_markers();
+  std::vector<int> added, removed;
+  for (int i = 0; i < n; ++i) {
+    if (next[i] && !cache.active[i]) added.push_back(i);
+    else if (!next[i] && cache.active[i]) removed.push_back(i);
+  }
+  const int changed = (int)(added.size() + removed.size());
+  if (changed == 0) return 0;
+
+  const bool recount = changed > STATS_CACHE_RECOUNT_FRACTION * n;
+  const bool all_active = std::find(next.begin(), next.end(), 0) == next.end();
+  ColumnBuffers cols(recount ? n_threads : 0, n);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    gvr::GenoCounts &c = cache.counts[j];
+    if (recount) {
+      count_kept_samples(geno, j, next, all_active, cols.thread(t), c);
+      return;
+    }
+    for (size_t k = 0; k < removed.size(); ++k) shift_counts(geno, removed[k], j, -1, c);
+    for (size_t k = 0; k < added.size(); ++k) shift_counts(geno, added[k], j, 1, c);
+  });
+  cache.active = next;
+  return changed;
+}
+
+inline int stats_cache_update(SEXP cache_sexp, LogicalVector sample_keep, int n_threads) {
+  MarkerStatsCache &cache = stats_cache(cache_sexp);
+  const int n = (int)cache.active.size();
+  if (sample_keep.size() != 0 && sample_keep.size() != n) stop("sample_keep must have one entry per sample");
+  std::vector<char> next(n, 1);
+  for (int i = 0; i < (int)sample_keep.size(); ++i) next[i] = sample_keep[i] == TRUE;
+
+  SEXP geno = R_ExternalPtrProtected(cache_sexp);
+  if (is_genotype_view(geno)) return stats_cache_update_impl(MaskedGenotypes(geno), cache, next, n_threads);
+  if (gvr::is_packed_genotypes(geno)) {
+    return stats_cache_update_impl(gvr::packed_genotypes(geno), cache, next, n_threads);
+  }
+  return stats_cache_update_impl(DosageMatrixView(geno), cache, next, n_threads);
+}
+
+// Builds a statistics cache over geno (matrix, packed store or view) with the
+// samples flagged in sample_keep active; empty keeps all samples.
+// [[Rcpp::export]]
+SEXP gvr_stats_cache(SEXP geno, LogicalVector sample_keep = LogicalVector(), int n_threads = 0) {
+  RObject base = geno;
+  int n = 0, m = 0;
+  if (is_genotype_view(geno)) {
+    const GenotypeMask &mask = genotype_mask(geno);
+    n = (int)mask.samples.size();
+    m = (int)mask.markers.size();
+  } else if (gvr::is_packed_genotypes(geno)) {
+    n = gvr::packed_genotypes(geno).n_samples();
+    m = gvr::packed_genotypes(geno).n_markers();
+  } else {
+    base = stored_dosage_matrix(geno);
+    n = Rf_nrows(base);
+    m = Rf_ncols(base);
+  }
+  MarkerStatsCache *cache = new MarkerStatsCache();
+  cache->counts.resize(m);
+  cache->active.assign(n, 0);
+  Rcpp::XPtr<MarkerStatsCache> ptr(cache, true, R_NilValue, base);
+  ptr.attr("class") = STATS_CACHE_CLASS;
+  stats_cache_update(ptr, sample_keep, gvr::resolve_threads(n_threads));
+  return ptr;
+}
+
+// Switches the active samples of a cache to sample_keep and returns the
+// marker statistics over them: call rate, MAF, heterozygosity and HWE exact
+// p-value, with the values gvr_qc_summary() gives for the same samples.
+// [[Rcpp::export]]
+List gvr_stats_cache_update(SEXP cache, LogicalVector sample_keep = LogicalVector(),
+                            bool hwe_midp = false, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  const int changed = stats_cache_update(cache, sample_keep, n_threads);
+  const MarkerStatsCache &c = stats_cache(cache);
+  const int m = (int)c.counts.size();
+  const int n_active = (int)std::count(c.active.begin(), c.active.end(), 1);
+
+  NumericVector marker_call_rate(m, NA_REAL), maf(m, NA_REAL), marker_het(m, NA_REAL), hwe_p(m, NA_REAL);
+  double *mcr_p = marker_call_rate.begin(), *maf_p = maf.begin();
+  double *mhet_p = marker_het.begin(), *hwe_pp = hwe_p.begin();
+  std::vector<gvr::HweExact> hwe = gvr::hwe_engines(n_threads);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    const gvr::GenoCounts &g = c.counts[j];
+    const int valid = g.valid();
+    if (n_active > 0) mcr_p[j] = (double)valid / (double)n_active;
+    if (valid == 0) return;
+    const double p = ((double)g.dosage_sum() / (double)valid) / 2.0;
+    maf_p[j] = std::min(p, 1.0 - p);
+    mhet_p[j] = (double)g.n1 / (double)valid;
+    hwe_pp[j] = hwe[t].pvalue(g.n1, g.n0, g.n2, hwe_midp);
+  });
+
+  return List::create(
+    _["marker_call_rate"] = marker_call_rate,
+    _["maf"] = maf,
+    _["marker_het"] = marker_het,
+    _["hwe_p"] = hwe_p,
+    _["n_samples"] = n_active,
+    _["changed_samples"] = changed
+  );
+}
+
+// Packs a dosage matrix (samples x markers; 0/1/2 copies of A1, NA missing)
+// into a 2-bit store that all gvr_* kernels accept in place of the matrix.
+// Cells that are not 0/1/2 are stored as missing, as the kernels treat them.
+// [[Rcpp::export]]
+SEXP gvr_pack_genotypes(NumericMatrix geno) {
+  const int n = geno.nrow(), m = geno.ncol();
+  Rcpp::XPtr<gvr::PackedGenotypes> store = gvr::make_packed_genotypes(n, m);
+  for (int j = 0; j < m; ++j) {
+    if ((j & 1023) == 0) Rcpp::checkUserInterrupt();
+    const double *x = geno.begin() + (size_t)j * (size_t)n;
+    for (int i = 0; i < n; ++i) {
+      int d = 0;
+      store->set_code(i, j, as_dosage(x[i], d) ? gvr::dosage_to_code(d) : gvr::CODE_MISSING);
+    }
+  }
+  return store;
+}
+
+// Loads a SNP-major PLINK .bed file into a packed store without decoding it.
+// Dosages count copies of A1 (the fifth .bim column), as in PLINK --recode A.
+// [[Rcpp::export]]
+SEXP gvr_pack_bed(std::string bed_path, int n_samples, int n_markers) {
+  if (n_samples < 0 || n_markers < 0) stop("n_samples and n_markers must be non-negative");
+  Rcpp::XPtr<gvr::PackedGenotypes> store = gvr::make_packed_genotypes(n_samples, n_markers);
+  store->read_bed(bed_path);
+  return store;
+}
+
+// Opens a PLINK binary fileset without decoding it: the .bed body is
+// memory-mapped and returned as a read-only packed store, alongside the
+// .fam sample table and .bim marker table.
+// [[Rcpp::export]]
+List gvr_read_plink_bfile(std::string bed_path, std::string bim_path, std::string fam_path) {
+  gvr::FamData fam;
+  gvr::BimData bim;
+  gvr::read_fam(fam_path, fam);
+  gvr::read_bim(bim_path, bim);
+
+  SEXP store = gvr::wrap_packed_genotypes(gvr::map_bed(bed_path, fam.size(), bim.size()));
+
+  NumericVector cm(bim.size()), bp(bim.size());
+  for (int j = 0; j < bim.size(); ++j) {
+    cm[j] = std::atof(bim.cm[j].c_str());
+    bp[j] = std::atof(bim.bp[j].c_str());
+  }
+  DataFrame samples = DataFrame::create(
+    _["FID"] = wrap(fam.fid), _["IID"] = wrap(fam.iid),
+    _["PAT"] = wrap(fam.pat), _["MAT"] = wrap(fam.mat),
+    _["SEX"] = wrap(fam.sex), _["PHENO"] = wrap(fam.pheno),
+    _["stringsAsFactors"] = false
+  );
+  DataFrame map = DataFrame::create(
+    _["CHR"] = wrap(bim.chr), _["SNP"] = wrap(bim.snp),
+    _["CM"] = cm, _["BP"] = bp,
+    _["A1"] = wrap(bim.a1), _["A2"] = wrap(bim.a2),
+    _["stringsAsFactors"] = false
+  );
+  return List::create(
+    _["genotypes"] = store,
+    _["samples"] = samples,
+    _["map"] = map
+  );
+}
+
+// Creates a lazy subset of geno (a dosage matrix, packed store or another
+// view) keeping the samples and markers flagged TRUE; an empty mask keeps
+// all. Every gvr_* kernel accepts the view in place of geno and reads only
+// the kept entries, so re-filtering costs O(kept indices) instead of a copy.
+// A view of a view refers straight to the underlying genotypes.
+// [[Rcpp::export]]
+SEXP gvr_genotype_view(SEXP geno, LogicalVector sample_keep = LogicalVector(),
+                       LogicalVector marker_keep = LogicalVector()) {
+  const GenotypeMask *parent = NULL;
+  RObject base = geno;
+  int n_base = 0, m_base = 0;
+  if (is_genotype_view(geno)) {
+    parent = &genotype_mask(geno);
+    base = R_ExternalPtrProtected(geno);
+    n_base = parent->base_samples;
+    m_base = parent->base_markers;
+  } else if (gvr::is_packed_genotypes(geno)) {
+    n_base = gvr::packed_genotypes(geno).n_samples();
+    m_base = gvr::packed_genotypes(geno).n_markers();
+  } else {
+    base = stored_dosage_matrix(geno);
+    n_base = Rf_nrows(base);
+    m_base = Rf_ncols(base);
+  }
+  const int n = parent ? (int)parent->samples.size() : n_base;
+  const int m = parent ? (int)parent->markers.size() : m_base;
+  if (sample_keep.size() != 0 && sample_keep.size() != n) {
+    stop("sample_keep must have one entry per sample");
+  }
+  const std::vector<char> keep_markers = marker_mask(marker_keep, m);
+
+  GenotypeMask *mask = new GenotypeMask();
+  mask->base_samples = n_base;
+  mask->base_markers = m_base;
+  for (int i = 0; i < n; ++i) {
+    if (sample_keep.size() != 0 && sample_keep[i] != TRUE) continue;
+    mask->samples.push_back(parent ? parent->samples[i] : i);
+  }
+  for (int j = 0; j < m; ++j) {
+    if (keep_markers[j]) mask->markers.push_back(parent ? parent->markers[j] : j);
+  }
+  Rcpp::XPtr<GenotypeMask> ptr(mask, true, R_NilValue, base);
+  ptr.attr("class") = GENOTYPE_VIEW_CLASS;
+  return ptr;
+}
+
+// Sizes of a packed store or genotype view; for a view, the kept sample and
+// marker indices (1-based) into the underlying genotypes as well.
+// [[Rcpp::export]]
+List gvr_packed_info(SEXP store) {
+  if (is_genotype_view(store)) {
+    const GenotypeMask &mask = genotype_mask(store);
+    IntegerVector samples(mask.samples.size()), markers(mask.markers.size());
+    for (size_t i = 0; i < mask.samples.size(); ++i) samples[i] = mask.samples[i] + 1;
+    for (size_t j = 0; j < mask.markers.size(); ++j) markers[j] = mask.markers[j] + 1;
+    return List::create(
+      _["n_samples"] = (int)mask.samples.size(),
+      _["n_markers"] = (int)mask.markers.size(),
+      _["samples"] = samples,
+      _["markers"] = markers
+    );
+  }
+  const gvr::PackedGenotypes &g = gvr::packed_genotypes(store);
+  return List::create(
+    _["n_samples"] = g.n_samples(),
+    _["n_markers"] = g.n_markers(),
+    _["bytes"] = (double)g.size_bytes(),
+    _["mapped"] = g.is_mapped()
+  );
+}
+
+// Expands a packed store back into a numeric dosage matrix (NA for missing).
+// [[Rcpp::export]]
+NumericMatrix gvr_unpack_genotypes(SEXP store) {
+  const gvr::PackedGenotypes &g = gvr::packed_genotypes(store);
+  const int n = g.n_samples(), m = g.n_markers();
+  NumericMatrix out(n, m);
+  std::vector<signed char> col(n);
+  for (int j = 0; j < m; ++j) {
+    g.decode_marker(j, col.data());
+    double *x = out.begin() + (size_t)j * (size_t)n;
+    for (int i = 0; i < n; ++i) x[i] = col[i] >= 0 ? (double)col[i] : NA_REAL;
+  }
+  return out;
+}
@@ -0,0 +1,90 @@
+#ifndef EASYBREEDER_GVR_THREADS_H
+#define EASYBREEDER_GVR_THREADS_H
+
+#include <Rcpp.h>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Marker-parallel execution for the genotype kernels.
+//
+// Work is split into marker blocks. Inside a block, markers are shared out
+// over OpenMP threads; between blocks the main thread checks for a user
+// interrupt, so no R API call is ever made from a worker. Every marker writes
+// only its own output slots and per-sample totals are integer counts merged
+// after the loop, so results are identical for any thread count.
+// Without OpenMP (e.g. Apple clang) everything runs serially.
+
+namespace gvr {
+
+// n_threads > 0 is used as given; otherwise getOption("easybreedeR.threads")
+// decides, and the default is a single thread.
+inline int resolve_threads(int n_threads) {
+  if (n_threads <= 0) {
+    SEXP opt = Rf_GetOption1(Rf_install("easybreedeR.threads"));
+    n_threads = 1;
+    if (!Rf_isNull(opt) && (TYPEOF(opt) == INTSXP || TYPEOF(opt) == REALSXP) && Rf_length(opt) >= 1) {
+      const int v = Rf_asInteger(opt);
+      if (v != NA_INTEGER && v > 0) n_threads = v;
+    }
+  }
+#ifdef _OPENMP
+  return std::max(1, n_threads);
+#else
+  return 1;
+#endif
+}
+
+inline int current_thread() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+const int MARKER_BLOCK = 4096;
+
+// Calls body(j, thread) for every marker j in [0, m). `thread` is in
+// [0, n_threads) and indexes per-thread scratch space. prepare(start, end)
+// runs on the main thread before each block, e.g. to copy R data the workers
+// need out of R objects.
+template <class Prepare, class Body>
+void parallel_marker_blocks(int m, int n_threads, Prepare prepare, Body body) {
+  for (int start = 0; start < m; start += MARKER_BLOCK) {
+    const int end = std::min(m, start + MARKER_BLOCK);
+    prepare(start, end);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic, 16) if (n_threads > 1)
+#endif
+    for (int j = start; j < end; ++j) body(j, current_thread());
+    Rcpp::checkUserInterrupt();
+  }
+}
+
+template <class Body>
+void parallel_markers(int m, int n_threads, Body body) {
+  parallel_marker_blocks(m, n_threads, [](int, int) {}, body);
+}
+
+// Calls body(k, thread) for k in [0, n_tasks) with tasks handed out one at a
+// time, for coarse work items of uneven cost (e.g. sample-pair tiles).
+// Interrupts are checked after every `block` tasks.
+template <class Body>
+void parallel_tasks(int n_tasks, int n_threads, int block, Body body) {
+  if (block < 1) block = 1;
+  for (int start = 0; start < n_tasks; start += block) {
+    const int end = std::min(n_tasks, start + block);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic, 1) if (n_threads > 1)
+#endif
+    for (int k = start; k < end; ++k) body(k, current_thread());
+    Rcpp::checkUserInterrupt();
+  }
+}
+
+} // namespace gvr
+
+#endif
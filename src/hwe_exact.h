@@ -0,0 +1,202 @@
+#ifndef EASYBREEDER_HWE_EXACT_H
+#define EASYBREEDER_HWE_EXACT_H
+
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Hardy-Weinberg exact test (Wigginton, Cutler & Abecasis 2005), as in PLINK.
+//
+// The null distribution of the heterozygote count depends only on the number
+// of called genotypes N and the rare-allele count. A first query for an
+// (N, rare count) pair is answered by one O(K) pass over that distribution;
+// once the pair comes up again (with complete data nearly every marker has
+// the same N), HweExact stores its p-value for every heterozygote count and
+// answers later markers with a lookup. Engines are not thread-safe: kernels
+// keep one per thread, made by hwe_engines() so that their caches share one
+// memory budget.
+
+namespace gvr {
+
+class HweExact {
+ public:
+  // Cached doubles shared by all engines of one kernel call (32 MB).
+  static const size_t TOTAL_CACHED = (size_t)1 << 22;
+
+  // max_cached bounds the number of cached doubles (and remembered pairs);
+  // the cache is dropped when it would grow past that.
+  explicit HweExact(size_t max_cached = TOTAL_CACHED) : max_cached_(max_cached), cached_(0) {}
+
+  // Two-sided p-value; midp subtracts half the probability of the observed
+  // table. NA_REAL when no genotypes are called.
+  double pvalue(int obs_hets, int obs_hom1, int obs_hom2, bool midp = false) {
+    const int obs_homr = std::min(obs_hom1, obs_hom2);
+    const int obs_homc = std::max(obs_hom1, obs_hom2);
+    const int rare_copies = 2 * obs_homr + obs_hets;
+    const int genotypes = obs_hets + obs_homc + obs_homr;
+    if (genotypes <= 0 || obs_hets < 0) return NA_REAL;
+    const int k = obs_hets >> 1;
+
+    const uint64_t key = ((uint64_t)(uint32_t)genotypes << 32) | (uint32_t)rare_copies;
+    auto it = cache_.find(key);
+    if (it != cache_.end()) return lookup(it->second, k, midp);
+
+    // First sighting: answer from the distribution alone and remember the
+    // pair; only a repeated pair pays for the full table.
+    if (seen_.count(key) == 0) {
+      reserve(1);
+      seen_.insert(key);
+      ++cached_;
+      if (!distribution(genotypes, rare_copies, probs_, prob_)) return NA_REAL;
+      double p = tail(prob_, mode(prob_), k);
+      if (midp) p -= 0.5 * prob_[k];
+      return p;
+    }
+
+    seen_.erase(key);
+    --cached_;
+    const size_t cost = 2 * ((size_t)rare_copies / 2 + 1);
+    reserve(cost);
+    Table& t = cache_[key];
+    build(genotypes, rare_copies, t);
+    cached_ += cost;
+    return lookup(t, k, midp);
+  }
+
+ private:
+  // Heterozygote counts of one parity, stored by index k = hets / 2.
+  struct Table {
+    std::vector<double> prob;
+    std::vector<double> pval;
+  };
+
+  static double lookup(const Table& t, int k, bool midp) {
+    if (t.pval.empty()) return NA_REAL;
+    double p = t.pval[k];
+    if (midp) p -= 0.5 * t.prob[k];
+    return p;
+  }
+
+  void reserve(size_t cost) {
+    if (cached_ + cost > max_cached_) {
+      cache_.clear();
+      seen_.clear();
+      cached_ = 0;
+    }
+  }
+
+  // Normalised null probabilities of the heterozygote counts with the parity
+  // of rare_copies, by index k = hets / 2; false when they vanish. probs is
+  // scratch space.
+  static bool distribution(int genotypes, int rare_copies, std::vector<double>& probs,
+                           std::vector<double>& prob) {
+    probs.assign(rare_copies + 1, 0.0);
+    int mid = (int) std::floor((double)rare_copies * (2.0 * genotypes - rare_copies) / (2.0 * genotypes));
+    if ((rare_copies & 1) != (mid & 1)) mid++;
+
+    int curr_hets = mid;
+    int curr_homr = (rare_copies - mid) / 2;
+    int curr_homc = genotypes - curr_hets - curr_homr;
+
+    probs[mid] = 1.0;
+    double sum = probs[mid];
+
+    while (curr_hets > 1) {
+      double p = probs[curr_hets] * curr_hets * (curr_hets - 1.0) /
+        (4.0 * (curr_homr + 1.0) * (curr_homc + 1.0));
+      probs[curr_hets - 2] = p;
+      sum += p;
+      curr_hets -= 2;
+      curr_homr += 1;
+      curr_homc += 1;
+    }
+
+    curr_hets = mid;
+    curr_homr = (rare_copies - mid) / 2;
+    curr_homc = genotypes - curr_hets - curr_homr;
+    while (curr_hets <= rare_copies - 2) {
+      double p = probs[curr_hets] * 4.0 * curr_homr * curr_homc /
+        ((curr_hets + 2.0) * (curr_hets + 1.0));
+      probs[curr_hets + 2] = p;
+      sum += p;
+      curr_hets += 2;
+      curr_homr -= 1;
+      curr_homc -= 1;
+    }
+
+    prob.clear();
+    if (sum <= 0.0) return false;
+
+    const int parity = rare_copies & 1;
+    const int K = (rare_copies - parity) / 2 + 1;
+    prob.resize(K);
+    for (int k = 0; k < K; ++k) prob[k] = probs[parity + 2 * k] / sum;
+    return true;
+  }
+
+  static int mode(const std::vector<double>& pr) {
+    return (int)(std::max_element(pr.begin(), pr.end()) - pr.begin());
+  }
+
+  // p-value of index k in one O(K) pass. The distribution is unimodal, so the
+  // states no more likely than the observed one are a prefix [0, a) and a
+  // suffix [b, K); they are summed in the same order as build() uses, so
+  // both paths give identical results.
+  static double tail(const std::vector<double>& pr, int mode, int k) {
+    const int K = (int)pr.size();
+    const double limit = pr[k] + 1e-12;
+    double left = 0.0;
+    for (int q = 0; q <= mode && pr[q] <= limit; ++q) left += pr[q];
+    double right = 0.0;
+    for (int q = K - 1; q > mode && pr[q] <= limit; --q) right += pr[q];
+    const double p = left + right;
+    return p > 1.0 ? 1.0 : p;
+  }
+
+  void build(int genotypes, int rare_copies, Table& t) {
+    std::vector<double> probs;
+    if (!distribution(genotypes, rare_copies, probs, t.prob)) return;
+    const std::vector<double>& pr = t.prob;
+    const int K = (int)pr.size();
+
+    // Tail sums come from prefix/suffix sums and the two boundaries from
+    // binary search.
+    const int top = mode(pr);
+    std::vector<double> lsum(top + 2, 0.0), rsum(K - top, 0.0);
+    for (int k = 0; k <= top; ++k) lsum[k + 1] = lsum[k] + pr[k];
+    for (int c = 1; c < K - top; ++c) rsum[c] = rsum[c - 1] + pr[K - c];
+
+    t.pval.resize(K);
+    for (int k = 0; k < K; ++k) {
+      const double limit = pr[k] + 1e-12;
+      // Left side pr[0..top] is non-decreasing; right side pr[top+1..K) non-increasing.
+      const int a = (int)(std::upper_bound(pr.begin(), pr.begin() + top + 1, limit) - pr.begin());
+      const int b = (int)(std::partition_point(pr.begin() + top + 1, pr.end(),
+                                               [&](double x) { return x > limit; }) - pr.begin());
+      const double p = lsum[a] + rsum[K - b];
+      t.pval[k] = p > 1.0 ? 1.0 : p;
+    }
+  }
+
+  size_t max_cached_;
+  size_t cached_;
+  std::unordered_map<uint64_t, Table> cache_;
+  std::unordered_set<uint64_t> seen_;
+  std::vector<double> probs_;
+  std::vector<double> prob_;
+};
+
+// One engine per thread, splitting HweExact::TOTAL_CACHED between them so a
+// kernel's cache memory does not grow with the thread count.
+inline std::vector<HweExact> hwe_engines(int n_threads) {
+  if (n_threads < 1) n_threads = 1;
+  return std::vector<HweExact>((size_t)n_threads, HweExact(HweExact::TOTAL_CACHED / (size_t)n_threads));
+}
+
+} // namespace gvr
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef EASYBREEDER_IBS_PLANES_H
+#define EASYBREEDER_IBS_PLANES_H
+
+#include <cstdint>
+#include <vector>
+
+// The AVX2 kernel is compiled with a function-level target attribute and
+// picked at run time, so default (CRAN) compiler flags still ship it.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GVR_IBS_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Bit-plane genotype layout for pairwise IBS counting.
+//
+// Each sample holds three bit vectors over the selected markers, 64 markers
+// per word: V (genotype called), H (heterozygous) and T (two copies of the
+// counted allele). Dosage 0 is V & ~H & ~T. For a pair of samples every IBS
+// tally is a popcount over word-wise logic:
+//   loci   = |Vi & Vj|
+//   IBS0   = |(Ti & Zj) | (Zi & Tj)|        (opposite homozygotes)
+//   IBS2   = |Vi & Vj & ~((Hi ^ Hj) | (Ti ^ Tj))|
+//   hethet = |Hi & Hj|
+// so a pair costs O(m / 64) word operations instead of O(m) scalar decodes.
+// On x86 CPUs with AVX2 (GCC/Clang builds) four words are counted per step.
+
+namespace gvr {
+
+struct IbsCounts {
+  int loci = 0;
+  int ibs0 = 0;
+  int ibs1 = 0;
+  int ibs2 = 0;
+  int hethet = 0;
+};
+
+inline int popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+inline int count_trailing_zeros64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(x);
+#else
+  int k = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    ++k;
+  }
+  return k;
+#endif
+}
+
+#ifdef GVR_IBS_AVX2
+// Per-64-bit-lane popcounts via a nibble lookup.
+__attribute__((target("avx2"))) inline __m256i popcount256(__m256i x) {
+  const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  const __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low));
+  const __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2"))) inline int64_t hsum256(__m256i x) {
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256((__m256i*)lanes, x);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// IBS tallies of whole 4-word steps of [w0, w1) for planes (vi, hi, ti) and
+// (vj, hj, tj), added to the totals; returns the first word not counted.
+__attribute__((target("avx2"))) inline size_t add_pair_avx2(
+    const uint64_t* vi, const uint64_t* hi, const uint64_t* ti,
+    const uint64_t* vj, const uint64_t* hj, const uint64_t* tj, size_t w0, size_t w1,
+    int64_t& loci, int64_t& ibs0, int64_t& ibs2, int64_t& hethet) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc_loci = zero, acc_ibs0 = zero, acc_ibs2 = zero, acc_hethet = zero;
+  size_t w = w0;
+  for (; w + 4 <= w1; w += 4) {
+    const __m256i a_v = _mm256_loadu_si256((const __m256i*)(vi + w));
+    const __m256i a_h = _mm256_loadu_si256((const __m256i*)(hi + w));
+    const __m256i a_t = _mm256_loadu_si256((const __m256i*)(ti + w));
+    const __m256i b_v = _mm256_loadu_si256((const __m256i*)(vj + w));
+    const __m256i b_h = _mm256_loadu_si256((const __m256i*)(hj + w));
+    const __m256i b_t = _mm256_loadu_si256((const __m256i*)(tj + w));
+    const __m256i both = _mm256_and_si256(a_v, b_v);
+    const __m256i a_z = _mm256_andnot_si256(_mm256_or_si256(a_h, a_t), a_v);
+    const __m256i b_z = _mm256_andnot_si256(_mm256_or_si256(b_h, b_t), b_v);
+    const __m256i opp = _mm256_or_si256(_mm256_and_si256(a_t, b_z), _mm256_and_si256(a_z, b_t));
+    const __m256i diff = _mm256_or_si256(_mm256_xor_si256(a_h, b_h), _mm256_xor_si256(a_t, b_t));
+    acc_loci = _mm256_add_epi64(acc_loci, popcount256(both));
+    acc_ibs0 = _mm256_add_epi64(acc_ibs0, popcount256(opp));
+    acc_ibs2 = _mm256_add_epi64(acc_ibs2, popcount256(_mm256_andnot_si256(diff, both)));
+    acc_hethet = _mm256_add_epi64(acc_hethet, popcount256(_mm256_and_si256(a_h, b_h)));
+  }
+  loci += hsum256(acc_loci);
+  ibs0 += hsum256(acc_ibs0);
+  ibs2 += hsum256(acc_ibs2);
+  hethet += hsum256(acc_hethet);
+  return w;
+}
+
+inline bool cpu_has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
+
+class IbsPlanes {
+ public:
+  IbsPlanes() : n_(0), m_(0), words_(0), avx2_(detect_avx2()) {}
+
+  IbsPlanes(int n_samples, int n_markers)
+    : n_(n_samples), m_(n_markers), words_(((size_t)n_markers + 63) / 64),
+      bits_((size_t)n_samples * 3 * words_, 0), avx2_(detect_avx2()) {}
+
+  int n_samples() const { return n_; }
+  int n_markers() const { return m_; }
+  size_t words() const { return words_; }
+
+  const uint64_t* called(int i) const { return bits_.data() + (size_t)i * 3 * words_; }
+  const uint64_t* het(int i) const { return called(i) + words_; }
+  const uint64_t* two(int i) const { return called(i) + 2 * words_; }
+
+  // Stores dosages for marker c; col[i] is 0/1/2, or negative for missing.
+  void set_marker(int c, const signed char* col) {
+    const size_t w = (size_t)c >> 6;
+    const uint64_t bit = (uint64_t)1 << (c & 63);
+    for (int i = 0; i < n_; ++i) {
+      const signed char d = col[i];
+      if (d < 0) continue;
+      uint64_t* v = bits_.data() + (size_t)i * 3 * words_;
+      v[w] |= bit;
+      if (d == 1) v[words_ + w] |= bit;
+      else if (d == 2) v[2 * words_ + w] |= bit;
+    }
+  }
+
+  IbsCounts count_pair(int i, int j) const {
+    IbsCounts out;
+    add_pair(i, j, 0, words_, out);
+    return out;
+  }
+
+  // Adds the tallies of words [w0, w1) of the pair to acc, so callers can
+  // sweep marker blocks that stay in cache across many pairs.
+  void add_pair(int i, int j, size_t w0, size_t w1, IbsCounts& acc) const {
+    const uint64_t *vi = called(i), *hi = het(i), *ti = two(i);
+    const uint64_t *vj = called(j), *hj = het(j), *tj = two(j);
+    int64_t loci = 0, ibs0 = 0, ibs2 = 0, hethet = 0;
+    size_t w = w0;
+#ifdef GVR_IBS_AVX2
+    if (avx2_) w = add_pair_avx2(vi, hi, ti, vj, hj, tj, w0, w1, loci, ibs0, ibs2, hethet);
+#endif
+    for (; w < w1; ++w) {
+      const uint64_t both = vi[w] & vj[w];
+      const uint64_t zi = vi[w] & ~(hi[w] | ti[w]);
+      const uint64_t zj = vj[w] & ~(hj[w] | tj[w]);
+      loci += popcount64(both);
+      ibs0 += popcount64((ti[w] & zj) | (zi & tj[w]));
+      ibs2 += popcount64(both & ~((hi[w] ^ hj[w]) | (ti[w] ^ tj[w])));
+      hethet += popcount64(hi[w] & hj[w]);
+    }
+    acc.loci += (int)loci;
+    acc.ibs0 += (int)ibs0;
+    acc.ibs2 += (int)ibs2;
+    acc.ibs1 = acc.loci - acc.ibs0 - acc.ibs2;
+    acc.hethet += (int)hethet;
+  }
+
+  // Adds to counts[6] how many loci in [c0, c1) the pair has in each unordered
+  // genotype pair class: {0,0}, {0,1}, {1,1}, {1,2}, {2,2}, {0,2}.
+  void add_genotype_pairs(int i, int j, int c0, int c1, int* counts) const {
+    if (c0 >= c1) return;
+    const uint64_t *vi = called(i), *hi = het(i), *ti = two(i);
+    const uint64_t *vj = called(j), *hj = het(j), *tj = two(j);
+    const size_t w0 = (size_t)c0 >> 6, w_last = (size_t)(c1 - 1) >> 6;
+    for (size_t w = w0; w <= w_last; ++w) {
+      uint64_t mask = ~(uint64_t)0;
+      if (w == w0) mask &= ~(uint64_t)0 << (c0 & 63);
+      if (w == w_last && (c1 & 63)) mask &= ~(~(uint64_t)0 << (c1 & 63));
+      const uint64_t zi = vi[w] & ~(hi[w] | ti[w]) & mask, zj = vj[w] & ~(hj[w] | tj[w]);
+      const uint64_t hm = hi[w] & mask, tm = ti[w] & mask;
+      counts[0] += popcount64(zi & zj);
+      counts[1] += popcount64((zi & hj[w]) | (hm & zj));
+      counts[2] += popcount64(hm & hj[w]);
+      counts[3] += popcount64((hm & tj[w]) | (tm & hj[w]));
+      counts[4] += popcount64(tm & tj[w]);
+      counts[5] += popcount64((zi & tj[w]) | (tm & zj));
+    }
+  }
+
+  // Calls f(c), in ascending order, for every marker c < m whose bit is set
+  // in word(w); e.g. word = Vi & Vj walks the loci a pair shares.
+  template <class Word, class F>
+  static void for_each_marker(size_t words, int m, Word word, F f) {
+    for (size_t w = 0; w < words; ++w) {
+      uint64_t bits = word(w);
+      while (bits) {
+        const int c = (int)(w << 6) + count_trailing_zeros64(bits);
+        if (c >= m) return;
+        f(c);
+        bits &= bits - 1;
+      }
+    }
+  }
+
+ private:
+  static bool detect_avx2() {
+#ifdef GVR_IBS_AVX2
+    return cpu_has_avx2();
+#else
+    return false;
+#endif
+  }
+
+  int n_;
+  int m_;
+  size_t words_;
+  std::vector<uint64_t> bits_;
+  bool avx2_;
+};
+
+} // namespace gvr
+
+#endif
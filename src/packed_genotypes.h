@@ -0,0 +1,233 @@
+#ifndef EASYBREEDER_PACKED_GENOTYPES_H
+#define EASYBREEDER_PACKED_GENOTYPES_H
+
+#include <Rcpp.h>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// PLINK-style 2-bit packed genotype store shared by the gvr_* kernels.
+//
+// Genotypes are kept SNP-major exactly as in a PLINK .bed body: one block of
+// ceil(n_samples / 4) bytes per marker, four samples per byte, low bits first.
+// 2-bit codes count copies of A1:
+//   00 = hom A1 (dosage 2), 01 = missing, 10 = het (dosage 1), 11 = hom A2 (dosage 0)
+// Header-only so that genotype_qc.cpp and plink_blup_convert.cpp can each be
+// compiled standalone with Rcpp::sourceCpp().
+
+namespace gvr {
+
+const char* const PACKED_GENOTYPES_CLASS = "gvr_packed_genotypes";
+
+const unsigned char CODE_HOM_A1 = 0;
+const unsigned char CODE_MISSING = 1;
+const unsigned char CODE_HET = 2;
+const unsigned char CODE_HOM_A2 = 3;
+
+// Missing value in one-byte (raw) dosage matrices, matching the BLUPF90
+// missing genotype code; the kernels read any byte other than 0/1/2 as
+// missing.
+const unsigned char RAW_DOSAGE_MISSING = 5;
+
+// Dosage (copies of A1) for each 2-bit code; -1 marks missing.
+inline int code_to_dosage(unsigned char code) {
+  static const int table[4] = {2, -1, 1, 0};
+  return table[code & 3];
+}
+
+inline unsigned char dosage_to_code(int d) {
+  static const unsigned char table[3] = {CODE_HOM_A2, CODE_HET, CODE_HOM_A1};
+  return (d >= 0 && d <= 2) ? table[d] : CODE_MISSING;
+}
+
+// Per-marker genotype tallies, indexed by dosage.
+struct GenoCounts {
+  int n0 = 0;
+  int n1 = 0;
+  int n2 = 0;
+  int missing = 0;
+  int valid() const { return n0 + n1 + n2; }
+  int dosage_sum() const { return n1 + 2 * n2; }
+};
+
+// Byte-wise lookup tables: how many of each 2-bit code a byte holds, and the
+// four dosages it decodes to.
+struct ByteTables {
+  unsigned char count[256][4];
+  signed char dosage[256][4];
+  ByteTables() {
+    for (int b = 0; b < 256; ++b) {
+      for (int k = 0; k < 4; ++k) count[b][k] = 0;
+      for (int k = 0; k < 4; ++k) {
+        const unsigned char code = (unsigned char)((b >> (2 * k)) & 3);
+        count[b][code]++;
+        dosage[b][k] = (signed char)code_to_dosage(code);
+      }
+    }
+  }
+};
+
+inline const ByteTables& byte_tables() {
+  static const ByteTables tables;
+  return tables;
+}
+
+inline size_t packed_bytes_per_marker(int n_samples) {
+  return ((size_t)n_samples + 3) / 4;
+}
+
+class PackedGenotypes {
+ public:
+  // Owned, writable store initialised to all-missing.
+  PackedGenotypes(int n_samples, int n_markers)
+    : n_samples_(n_samples), n_markers_(n_markers),
+      bytes_per_marker_(packed_bytes_per_marker(n_samples)),
+      bytes_(bytes_per_marker_ * (size_t)n_markers, 0x55),
+      data_(bytes_.data()) {}
+
+  // Read-only view over genotype bytes kept alive by `backing`
+  // (e.g. a memory-mapped .bed file).
+  PackedGenotypes(int n_samples, int n_markers, const unsigned char* data,
+                  std::shared_ptr<void> backing)
+    : n_samples_(n_samples), n_markers_(n_markers),
+      bytes_per_marker_(packed_bytes_per_marker(n_samples)),
+      data_(data), backing_(backing) {}
+
+  PackedGenotypes(const PackedGenotypes&) = delete;
+  PackedGenotypes& operator=(const PackedGenotypes&) = delete;
+
+  int n_samples() const { return n_samples_; }
+  int n_markers() const { return n_markers_; }
+  size_t bytes_per_marker() const { return bytes_per_marker_; }
+  size_t size_bytes() const { return bytes_per_marker_ * (size_t)n_markers_; }
+  bool is_mapped() const { return backing_ != nullptr; }
+
+  const unsigned char* marker(int j) const { return data_ + (size_t)j * bytes_per_marker_; }
+  unsigned char* marker(int j) {
+    if (is_mapped()) Rcpp::stop("Cannot modify a memory-mapped genotype store");
+    return bytes_.data() + (size_t)j * bytes_per_marker_;
+  }
+
+  unsigned char code(int i, int j) const {
+    return (unsigned char)((marker(j)[i >> 2] >> ((i & 3) * 2)) & 3);
+  }
+
+  void set_code(int i, int j, unsigned char code) {
+    unsigned char& b = marker(j)[i >> 2];
+    const int shift = (i & 3) * 2;
+    b = (unsigned char)((b & ~(3 << shift)) | ((code & 3) << shift));
+  }
+
+  bool dosage(int i, int j, int& out) const {
+    const int d = code_to_dosage(code(i, j));
+    if (d < 0) return false;
+    out = d;
+    return true;
+  }
+
+  void count_marker(int j, GenoCounts& c) const {
+    const ByteTables& t = byte_tables();
+    const unsigned char* col = marker(j);
+    const int full = n_samples_ >> 2;
+    int k[4] = {0, 0, 0, 0};
+    for (int b = 0; b < full; ++b) {
+      const unsigned char* cnt = t.count[col[b]];
+      k[0] += cnt[0];
+      k[1] += cnt[1];
+      k[2] += cnt[2];
+      k[3] += cnt[3];
+    }
+    // Padding bits in the last byte are not genotypes; decode the tail one by one.
+    for (int i = full << 2; i < n_samples_; ++i) k[code(i, j)]++;
+    c.n2 = k[CODE_HOM_A1];
+    c.missing = k[CODE_MISSING];
+    c.n1 = k[CODE_HET];
+    c.n0 = k[CODE_HOM_A2];
+  }
+
+  // Decodes marker j into out[0..n_samples): 0/1/2, or -1 for missing.
+  void decode_marker(int j, signed char* out) const {
+    const ByteTables& t = byte_tables();
+    const unsigned char* col = marker(j);
+    const int full = n_samples_ >> 2;
+    for (int b = 0; b < full; ++b) {
+      const signed char* d = t.dosage[col[b]];
+      out[4 * b] = d[0];
+      out[4 * b + 1] = d[1];
+      out[4 * b + 2] = d[2];
+      out[4 * b + 3] = d[3];
+    }
+    for (int i = full << 2; i < n_samples_; ++i) out[i] = (signed char)code_to_dosage(code(i, j));
+  }
+
+  // Loads the body of a SNP-major PLINK .bed file into an owned store.
+  void read_bed(const std::string& path) {
+    if (is_mapped()) Rcpp::stop("Cannot load into a memory-mapped genotype store");
+    std::FILE* fp = std::fopen(path.c_str(), "rb");
+    if (!fp) Rcpp::stop("Cannot open .bed file: " + path);
+    unsigned char magic[3] = {0, 0, 0};
+    const size_t got = std::fread(magic, 1, 3, fp);
+    if (got != 3 || magic[0] != 0x6c || magic[1] != 0x1b) {
+      std::fclose(fp);
+      Rcpp::stop("Not a PLINK .bed file (bad magic number): " + path);
+    }
+    if (magic[2] != 0x01) {
+      std::fclose(fp);
+      Rcpp::stop("Only SNP-major .bed files are supported: " + path);
+    }
+    size_t body = std::fread(bytes_.data(), 1, bytes_.size(), fp);
+    // Count any bytes past the expected body so a dimension mismatch is
+    // reported instead of silently misaligning genotypes.
+    if (body == bytes_.size()) {
+      char extra[4096];
+      size_t got_extra;
+      while ((got_extra = std::fread(extra, 1, sizeof(extra), fp)) > 0) body += got_extra;
+    }
+    std::fclose(fp);
+    if (body != bytes_.size()) {
+      Rcpp::stop(std::string(body < bytes_.size() ? "Truncated" : "Oversized") + " .bed file: expected " +
+                 std::to_string(bytes_.size()) + " genotype bytes for " + std::to_string(n_samples_) +
+                 " samples x " + std::to_string(n_markers_) + " markers, found " + std::to_string(body) +
+                 " (do the .fam/.bim files match?)");
+    }
+  }
+
+ private:
+  int n_samples_;
+  int n_markers_;
+  size_t bytes_per_marker_;
+  std::vector<unsigned char> bytes_;
+  const unsigned char* data_;
+  std::shared_ptr<void> backing_;
+};
+
+inline bool is_packed_genotypes(SEXP x) {
+  return TYPEOF(x) == EXTPTRSXP && Rf_inherits(x, PACKED_GENOTYPES_CLASS);
+}
+
+inline const PackedGenotypes& packed_genotypes(SEXP x) {
+  if (!is_packed_genotypes(x)) Rcpp::stop("Expected a gvr_packed_genotypes object");
+  Rcpp::XPtr<PackedGenotypes> ptr(x);
+  if (ptr.get() == NULL) {
+    Rcpp::stop("Packed genotype store is no longer valid (objects cannot be saved across sessions)");
+  }
+  return *ptr;
+}
+
+inline Rcpp::XPtr<PackedGenotypes> wrap_packed_genotypes(PackedGenotypes* store) {
+  Rcpp::XPtr<PackedGenotypes> ptr(store, true);
+  ptr.attr("class") = PACKED_GENOTYPES_CLASS;
+  return ptr;
+}
+
+// Allocates an all-missing store owned by an R external pointer, so it is
+// released by the garbage collector even if filling it is interrupted.
+inline Rcpp::XPtr<PackedGenotypes> make_packed_genotypes(int n_samples, int n_markers) {
+  return wrap_packed_genotypes(new PackedGenotypes(n_samples, n_markers));
+}
+
+} // namespace gvr
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef EASYBREEDER_PLINK_BFILE_H
+#define EASYBREEDER_PLINK_BFILE_H
+
+#include <Rcpp.h>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "packed_genotypes.h"
+
+// Native PLINK binary fileset (.bed/.bim/.fam) access.
+// The .bed body is memory-mapped read-only and handed to the gvr_* kernels as
+// a gvr::PackedGenotypes view, so genotypes are paged in from disk as the
+// kernels sweep markers instead of being copied into an R matrix.
+
+namespace gvr {
+
+// Read-only mapping of a whole file: mmap() on POSIX systems, a file mapping
+// object on Windows.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) : data_(NULL), size_(0) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) Rcpp::stop("Cannot open file: " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      Rcpp::stop("Cannot stat file: " + path);
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ > 0) {
+      void* p = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        Rcpp::stop("Cannot memory-map file: " + path);
+      }
+      // Kernels sweep markers front to back: read ahead, and let pages behind
+      // the sweep be reclaimed first so resident memory stays flat.
+      ::posix_madvise(p, size_, POSIX_MADV_SEQUENTIAL);
+      data_ = static_cast<const unsigned char*>(p);
+    }
+    ::close(fd);
+#else
+    HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) Rcpp::stop("Cannot open file: " + path);
+    LARGE_INTEGER len;
+    if (!::GetFileSizeEx(file, &len)) {
+      ::CloseHandle(file);
+      Rcpp::stop("Cannot stat file: " + path);
+    }
+    if ((unsigned long long)len.QuadPart > (unsigned long long)(std::numeric_limits<size_t>::max)()) {
+      ::CloseHandle(file);
+      Rcpp::stop("File too large to map in this build: " + path);
+    }
+    size_ = (size_t)len.QuadPart;
+    if (size_ > 0) {
+      // The view keeps the mapping alive, so both handles can be closed.
+      HANDLE mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      void* p = mapping != NULL ? ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+      if (mapping != NULL) ::CloseHandle(mapping);
+      if (p == NULL) {
+        ::CloseHandle(file);
+        Rcpp::stop("Cannot memory-map file: " + path);
+      }
+      data_ = static_cast<const unsigned char*>(p);
+    }
+    ::CloseHandle(file);
+#endif
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (data_ != NULL && size_ > 0) ::munmap(const_cast<unsigned char*>(data_), size_);
+#else
+    if (data_ != NULL) ::UnmapViewOfFile(data_);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const unsigned char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const unsigned char* data_;
+  size_t size_;
+};
+
+struct FamData {
+  std::vector<std::string> fid, iid, pat, mat, sex, pheno;
+  int size() const { return (int)iid.size(); }
+};
+
+struct BimData {
+  std::vector<std::string> chr, snp, cm, bp, a1, a2;
+  int size() const { return (int)snp.size(); }
+};
+
+// Splits a whitespace-delimited line; returns the number of fields read.
+inline int split_fields(const std::string& line, std::vector<std::string>& fields) {
+  fields.clear();
+  std::istringstream iss(line);
+  std::string tok;
+  while (iss >> tok) fields.push_back(tok);
+  return (int)fields.size();
+}
+
+inline void read_fam(const std::string& path, FamData& fam) {
+  std::ifstream in(path.c_str());
+  if (!in) Rcpp::stop("Cannot open .fam file: " + path);
+  std::string line;
+  std::vector<std::string> f;
+  int line_no = 0;
+  while (std::getline(in, line)) {
+    ++line_no;
+    const int nf = split_fields(line, f);
+    if (nf == 0) continue;
+    if (nf < 6) Rcpp::stop(".fam line " + std::to_string(line_no) + " has fewer than 6 columns: " + path);
+    fam.fid.push_back(f[0]);
+    fam.iid.push_back(f[1]);
+    fam.pat.push_back(f[2]);
+    fam.mat.push_back(f[3]);
+    fam.sex.push_back(f[4]);
+    fam.pheno.push_back(f[5]);
+  }
+}
+
+inline void read_bim(const std::string& path, BimData& bim) {
+  std::ifstream in(path.c_str());
+  if (!in) Rcpp::stop("Cannot open .bim file: " + path);
+  std::string line;
+  std::vector<std::string> f;
+  int line_no = 0;
+  while (std::getline(in, line)) {
+    ++line_no;
+    const int nf = split_fields(line, f);
+    if (nf == 0) continue;
+    if (nf < 6) Rcpp::stop(".bim line " + std::to_string(line_no) + " has fewer than 6 columns: " + path);
+    bim.chr.push_back(f[0]);
+    bim.snp.push_back(f[1]);
+    bim.cm.push_back(f[2]);
+    bim.bp.push_back(f[3]);
+    bim.a1.push_back(f[4]);
+    bim.a2.push_back(f[5]);
+  }
+}
+
+// Copies the non-blank lines of a .fam/.bim file whose keep flag is set to
+// `out_path`, verbatim. keep has one entry per non-blank line, as counted by
+// read_fam()/read_bim().
+inline void copy_kept_lines(const std::string& in_path, const std::string& out_path,
+                            const std::vector<char>& keep) {
+  std::ifstream in(in_path.c_str());
+  if (!in) Rcpp::stop("Cannot open file: " + in_path);
+  std::ofstream out(out_path.c_str());
+  if (!out) Rcpp::stop("Cannot open output file: " + out_path);
+  std::string line;
+  std::vector<std::string> f;
+  size_t k = 0;
+  while (std::getline(in, line)) {
+    if (split_fields(line, f) == 0) continue;
+    if (k >= keep.size()) Rcpp::stop("More records than expected in " + in_path);
+    if (keep[k++]) out << line << '\n';
+  }
+  if (k != keep.size()) Rcpp::stop("Fewer records than expected in " + in_path);
+  out.close();
+  if (!out) Rcpp::stop("Error writing file: " + out_path);
+}
+
+// Maps a SNP-major .bed file and returns a read-only store over its body.
+inline PackedGenotypes* map_bed(const std::string& path, int n_samples, int n_markers) {
+  std::shared_ptr<MappedFile> file(new MappedFile(path));
+  const unsigned char* p = file->data();
+  if (file->size() < 3 || p[0] != 0x6c || p[1] != 0x1b) {
+    Rcpp::stop("Not a PLINK .bed file (bad magic number): " + path);
+  }
+  if (p[2] != 0x01) Rcpp::stop("Only SNP-major .bed files are supported: " + path);
+  const size_t expected = packed_bytes_per_marker(n_samples) * (size_t)n_markers;
+  const size_t body = file->size() - 3;
+  if (body != expected) {
+    Rcpp::stop(std::string(body < expected ? "Truncated" : "Oversized") + " .bed file: expected " +
+               std::to_string(expected) + " genotype bytes for " + std::to_string(n_samples) +
+               " samples x " + std::to_string(n_markers) + " markers, found " + std::to_string(body) +
+               " (do the .fam/.bim files match?)");
+  }
+  return new PackedGenotypes(n_samples, n_markers, p + 3, file);
+}
+
+} // namespace gvr
+
+#endif
@@ -1,18 +1,34 @@
+// [[Rcpp::plugins(openmp)]]
 #include <Rcpp.h>
 #include <algorithm>
 #include <cctype>
 #include <cmath>
-#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#ifdef EB_USE_ZLIB
+#include <zlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#include "gvr_threads.h"
+#include "hwe_exact.h"
+#include "packed_genotypes.h"
+#include "plink_bfile.h"
+
 using namespace Rcpp;
 
 namespace {
 
-const char* PED_DOT_AS_ALLELE_SENTINEL = "__PLINK_PED_DOT_ALLELE__";
-
 std::string trim_copy(const std::string& x) {
   std::string s = x;
   auto not_space = [](unsigned char ch) { return !std::isspace(ch); };
@@ -28,104 +44,809 @@ std::string upper_copy(std::string x) {
   return x;
 }
 
-std::string normalize_allele(SEXP x) {
-  if (x == NA_STRING) {
-    return "";
+bool is_missing_allele(const std::string& a) {
+  return a.empty() || a == "0" || a == "NA" || a == "N" || a == "." || a == "-9";
+}
+
+// Per-marker allele interning: each distinct allele gets code 1, 2, ... in
+// order of first appearance. SNP alleles are almost always one character
+// (A/C/G/T/I/D...), which map through a 256-entry table; only longer alleles
+// (indels) fall back to a dictionary. Reused across markers via clear().
+class AlleleInterner {
+public:
+  AlleleInterner() : single_(256, 0) {}
+
+  void clear() {
+    for (size_t k = 0; k < labels_.size(); ++k) {
+      if (labels_[k].size() == 1) single_[(unsigned char)labels_[k][0]] = 0;
+    }
+    multi_.clear();
+    labels_.clear();
+  }
+
+  int intern(char c) {
+    int& code = single_[(unsigned char)c];
+    if (code == 0) {
+      labels_.push_back(std::string(1, c));
+      code = (int)labels_.size();
+    }
+    return code;
+  }
+
+  int intern(const std::string& a) {
+    if (a.size() == 1) return intern(a[0]);
+    std::unordered_map<std::string, int>::iterator it = multi_.find(a);
+    if (it != multi_.end()) return it->second;
+    labels_.push_back(a);
+    const int code = (int)labels_.size();
+    multi_.emplace(a, code);
+    return code;
+  }
+
+  int size() const { return (int)labels_.size(); }
+  const std::string& label(int code) const { return labels_[code - 1]; }
+  const std::vector<std::string>& labels() const { return labels_; }
+
+private:
+  std::vector<int> single_;
+  std::unordered_map<std::string, int> multi_;
+  std::vector<std::string> labels_;
+};
+
+// Codes of the most and second most frequent alleles given per-code counts
+// (counts[k - 1] for code k); 0 when there is no such allele. Ties go to the
+// allele seen first, as in PLINK.
+void top_two_alleles(const std::vector<int>& counts, int& major, int& minor) {
+  major = minor = 0;
+  for (int k = 0; k < (int)counts.size(); ++k) {
+    if (major == 0 || counts[k] > counts[major - 1]) {
+      minor = major;
+      major = k + 1;
+    } else if (minor == 0 || counts[k] > counts[minor - 1]) {
+      minor = k + 1;
+    }
   }
-  std::string s = trim_copy(as<std::string>(x));
-  return upper_copy(s);
 }
 
-// PLINK .ped parsing can preserve "." as an actual allele (it later appears as
-// "0" in BIM/RAW labels), distinct from the default missing genotype code "0".
-// Keep a private sentinel to avoid conflating "." with missing during coding.
-std::string normalize_allele_for_plink_ped(SEXP x) {
-  std::string s = normalize_allele(x);
-  if (s == ".") return PED_DOT_AS_ALLELE_SENTINEL;
-  return s;
+// Splits a PED genotype cell such as "A T" into its two allele tokens, as
+// pointers into the cell and lengths; false unless the cell holds exactly two
+// whitespace-separated tokens (such cells are unparsable and count as missing).
+bool split_ped_cell(const char* p, const char* tok[2], int len[2]) {
+  for (int k = 0; k < 2; ++k) {
+    while (*p && std::isspace((unsigned char)*p)) ++p;
+    if (!*p) return false;
+    tok[k] = p;
+    while (*p && !std::isspace((unsigned char)*p)) ++p;
+    len[k] = (int)(p - tok[k]);
+  }
+  while (*p && std::isspace((unsigned char)*p)) ++p;
+  return *p == '\0';
+}
+
+// C strings of a block of CharacterMatrix columns, borrowed on the main thread
+// so marker-parallel workers never call into R. NA cells are NULL.
+class CellBlock {
+public:
+  explicit CellBlock(const CharacterMatrix& x) : x_(x), n_(x.nrow()), start_(0) {}
+
+  void load(int start, int end) {
+    start_ = start;
+    cells_.resize((size_t)n_ * (size_t)(end - start));
+    SEXP xs = x_;
+    for (int j = start; j < end; ++j) {
+      for (int i = 0; i < n_; ++i) {
+        SEXP el = STRING_ELT(xs, (R_xlen_t)i + (R_xlen_t)j * n_);
+        cells_[(size_t)(j - start) * n_ + i] = (el == NA_STRING) ? NULL : CHAR(el);
+      }
+    }
+  }
+
+  const char* operator()(int i, int j) const { return cells_[(size_t)(j - start_) * n_ + i]; }
+
+private:
+  const CharacterMatrix& x_;
+  int n_;
+  int start_;
+  std::vector<const char*> cells_;
+};
+
+const char* const PED_ENCODING_CLASS = "gvr_ped_encoding";
+
+// Distinct alleles one marker can hold in a PedEncoding (codes 1..255).
+const int PED_MAX_ALLELES = 255;
+
+// PED genotype strings encoded once for all *_from_ped_strings statistics.
+// Each cell becomes two one-byte allele codes, marker-major: 0 for a missing
+// allele (an unparsable or NA cell has both codes 0), otherwise k for the
+// k-th distinct allele of the marker in order of first appearance. Allele
+// labels and copy counts are kept per marker, so the top-2 alleles need no
+// further pass over the strings.
+class PedEncoding {
+public:
+  PedEncoding(int n, int m)
+    : n_(n), m_(m), codes_((size_t)2 * n * m, 0), alleles_(m), counts_(m) {}
+
+  int n_samples() const { return n_; }
+  int n_markers() const { return m_; }
+
+  const unsigned char* marker(int j) const { return codes_.data() + (size_t)2 * n_ * j; }
+  unsigned char* marker(int j) { return codes_.data() + (size_t)2 * n_ * j; }
+
+  std::vector<std::string>& alleles(int j) { return alleles_[j]; }
+  std::vector<int>& counts(int j) { return counts_[j]; }
+
+  void top_two(int j, int& major, int& minor) const { top_two_alleles(counts_[j], major, minor); }
+
+private:
+  int n_;
+  int m_;
+  std::vector<unsigned char> codes_;
+  std::vector<std::vector<std::string>> alleles_;
+  std::vector<std::vector<int>> counts_;
+};
+
+// Encodes marker j; returns false if it has more than PED_MAX_ALLELES alleles.
+// Alleles are upper-cased and the missing codes of is_missing_allele() give 0.
+bool encode_ped_marker(const CellBlock& cells, int j, PedEncoding& enc,
+                       AlleleInterner& interner, std::string& buf) {
+  const int n = enc.n_samples();
+  unsigned char* codes = enc.marker(j);
+  std::vector<int>& counts = enc.counts(j);
+  interner.clear();
+  const char* tok[2];
+  int len[2];
+  for (int i = 0; i < n; ++i) {
+    const char* cell = cells(i, j);
+    if (cell == NULL || !split_ped_cell(cell, tok, len)) continue;
+    for (int k = 0; k < 2; ++k) {
+      int code;
+      if (len[k] == 1) {
+        const char c = (char)std::toupper((unsigned char)tok[k][0]);
+        if (c == '0' || c == 'N' || c == '.') continue;
+        code = interner.intern(c);
+      } else {
+        buf.assign(tok[k], len[k]);
+        for (size_t q = 0; q < buf.size(); ++q) buf[q] = (char)std::toupper((unsigned char)buf[q]);
+        if (is_missing_allele(buf)) continue;
+        code = interner.intern(buf);
+      }
+      if (code > PED_MAX_ALLELES) return false;
+      if (code > (int)counts.size()) counts.push_back(0);
+      counts[code - 1]++;
+      codes[2 * i + k] = (unsigned char)code;
+    }
+  }
+  enc.alleles(j) = interner.labels();
+  return true;
 }
 
-std::string plink_ped_output_allele_label(const std::string& a) {
-  if (a == PED_DOT_AS_ALLELE_SENTINEL) return "0";
-  return a;
+PedEncoding* encode_ped_strings(const CharacterMatrix& geno_pairs, int n_threads) {
+  const int n = geno_pairs.nrow();
+  const int m = geno_pairs.ncol();
+  std::unique_ptr<PedEncoding> enc(new PedEncoding(n, m));
+  std::vector<AlleleInterner> interners(n_threads);
+  std::vector<std::string> bufs(n_threads);
+  std::vector<char> overflow(m, 0);
+  CellBlock cells(geno_pairs);
+  gvr::parallel_marker_blocks(m, n_threads,
+                              [&](int start, int end) { cells.load(start, end); },
+                              [&](int j, int t) {
+    if (!encode_ped_marker(cells, j, *enc, interners[t], bufs[t])) overflow[j] = 1;
+  });
+  for (int j = 0; j < m; ++j) {
+    if (overflow[j]) {
+      stop("Marker " + std::to_string(j + 1) + " has more than " +
+           std::to_string(PED_MAX_ALLELES) + " distinct alleles");
+    }
+  }
+  return enc.release();
 }
 
-bool is_missing_allele(const std::string& a) {
-  return a.empty() || a == "0" || a == "NA" || a == "N" || a == "." || a == "-9";
+// The encoding behind a *_from_ped_strings argument: a gvr_encode_ped_strings()
+// object is used as is; a character matrix is encoded into `owned`.
+const PedEncoding& ped_encoding(SEXP geno_pairs, int n_threads, std::unique_ptr<PedEncoding>& owned) {
+  if (TYPEOF(geno_pairs) == EXTPTRSXP && Rf_inherits(geno_pairs, PED_ENCODING_CLASS)) {
+    Rcpp::XPtr<PedEncoding> ptr(geno_pairs);
+    if (ptr.get() == NULL) {
+      stop("PED encoding is no longer valid (objects cannot be saved across sessions)");
+    }
+    return *ptr;
+  }
+  if (TYPEOF(geno_pairs) != STRSXP || !Rf_isMatrix(geno_pairs)) {
+    stop("geno_pairs must be a character matrix or a gvr_encode_ped_strings() object");
+  }
+  owned.reset(encode_ped_strings(CharacterMatrix(geno_pairs), n_threads));
+  return *owned;
 }
 
-// PLINK .ped default missing genotype code is "0" (unless --missing-genotype
-// is specified). To mirror plink/plinkR conversion behavior, do not treat
-// strings like N/NA/./-9 as missing here.
-bool is_missing_allele_plink_ped_default(const std::string& a) {
-  return a.empty() || a == "0";
+// Copies of `minor` in the genotype (a, b), or -1 when either allele is
+// missing or is neither the major nor the minor allele (alleles beyond the
+// top two are treated as missing). With minor == 0 (monomorphic marker) the
+// observed homozygote codes as 0.
+inline int minor_allele_copies(int a, int b, int major, int minor) {
+  if (a == 0 || b == 0) return -1;
+  if ((a != major && a != minor) || (b != major && b != minor)) return -1;
+  return (a == minor) + (b == minor);
 }
 
-bool parse_ped_pair(const std::string& s_in, std::string& a, std::string& b) {
-  std::string s = upper_copy(trim_copy(s_in));
-  if (s.empty()) return false;
-  std::istringstream iss(s);
-  std::string t1, t2, extra;
-  if (!(iss >> t1)) return false;
-  if (!(iss >> t2)) return false;
-  if (iss >> extra) return false;
-  a = t1;
-  b = t2;
-  return true;
+// Dosage output of the converters in the layout the caller asks for:
+//   "double"  numeric matrix, NA for missing
+//   "integer" integer matrix, 5 (the BLUPF90 missing code) for missing
+//   "raw"     one byte per genotype, gvr::RAW_DOSAGE_MISSING for missing
+//   "packed"  2-bit gvr_packed_genotypes store
+// The gvr_* kernels read "raw" and "packed" in place. Columns arrive as
+// 0/1/2 with -1 for missing; each marker's column is written by one worker.
+class DosageSink {
+public:
+  DosageSink(const std::string& format, int n, int m)
+    : n_(n), real_(NULL), int_(NULL), raw_(NULL), packed_(NULL) {
+    if (format == "double") {
+      NumericMatrix x(n, m);
+      real_ = x.begin();
+      out_ = x;
+    } else if (format == "integer") {
+      IntegerMatrix x(n, m);
+      int_ = x.begin();
+      out_ = x;
+    } else if (format == "raw") {
+      RawMatrix x(n, m);
+      raw_ = x.begin();
+      out_ = x;
+    } else if (format == "packed") {
+      Rcpp::XPtr<gvr::PackedGenotypes> store = gvr::make_packed_genotypes(n, m);
+      packed_ = store.get();
+      out_ = store;
+    } else {
+      stop("output must be \"double\", \"integer\", \"raw\" or \"packed\"");
+    }
+  }
+
+  void put(int j, const signed char* col) {
+    const size_t off = (size_t)j * (size_t)n_;
+    if (real_) {
+      for (int i = 0; i < n_; ++i) real_[off + i] = col[i] < 0 ? NA_REAL : (double)col[i];
+    } else if (int_) {
+      for (int i = 0; i < n_; ++i) int_[off + i] = col[i] < 0 ? 5 : (int)col[i];
+    } else if (raw_) {
+      for (int i = 0; i < n_; ++i) raw_[off + i] = col[i] < 0 ? gvr::RAW_DOSAGE_MISSING : (Rbyte)col[i];
+    } else {
+      unsigned char* bytes = packed_->marker(j);
+      std::fill(bytes, bytes + packed_->bytes_per_marker(), 0);
+      for (int i = 0; i < n_; ++i) bytes[i >> 2] |= (unsigned char)(gvr::dosage_to_code(col[i]) << ((i & 3) * 2));
+    }
+  }
+
+  // Stores one genotype (0/1/2, or -1 for missing), for row-wise producers.
+  void set(int i, int j, signed char d) {
+    const size_t k = (size_t)j * (size_t)n_ + (size_t)i;
+    if (real_) {
+      real_[k] = d < 0 ? NA_REAL : (double)d;
+    } else if (int_) {
+      int_[k] = d < 0 ? 5 : (int)d;
+    } else if (raw_) {
+      raw_[k] = d < 0 ? gvr::RAW_DOSAGE_MISSING : (Rbyte)d;
+    } else {
+      packed_->set_code(i, j, gvr::dosage_to_code(d));
+    }
+  }
+
+  SEXP result() const { return out_; }
+
+private:
+  int n_;
+  double* real_;
+  int* int_;
+  Rbyte* raw_;
+  gvr::PackedGenotypes* packed_;
+  RObject out_;
+};
+
+// PLINK's A1/A2 choice for one marker of a .ped file. counts[k - 1] holds the
+// copies of allele k (codes in first-seen order); effective(k1, k2, c1, c2)
+// gives the copies of the top two alleles once genotypes carrying any other
+// allele are dropped, which is what PLINK ranks them by. a1/a2 are set to
+// allele codes, 0 standing for PLINK's "0" allele.
+template <class EffectiveCounts>
+void plink_ped_a1_a2(const std::vector<int>& counts, EffectiveCounts effective, int& a1, int& a2) {
+  int top1 = 0;
+  int top2 = 0;
+  top_two_alleles(counts, top1, top2);
+  a1 = 0;
+  a2 = 0;
+  if (top1 == 0) return;
+  if (top2 == 0) {
+    // Monomorphic: A1=0, A2=observed allele.
+    a2 = top1;
+    return;
+  }
+  int c1 = 0;
+  int c2 = 0;
+  effective(top1, top2, c1, c2);
+  if (c1 == 0 && c2 == 0) {
+    // Pathological corner case; fall back to pre-drop counts to keep output deterministic.
+    c1 = counts[top1 - 1];
+    c2 = counts[top2 - 1];
+  }
+  // A1 is minor; on a tie PLINK keeps the preselected order (A1=second, A2=top).
+  if (c1 < c2) {
+    a1 = top1;
+    a2 = top2;
+  } else {
+    a1 = top2;
+    a2 = top1;
+  }
+}
+
+// BLUPF90 dosage of genotype (x, y) given the marker's A1/A2 codes: copies of
+// the counted allele, or -1 for missing (a missing allele, or one that is
+// neither A1 nor A2). Monomorphic markers (A1 = 0) code the observed
+// homozygote as 0 copies of A1, i.e. 2 when counting A2.
+inline int blup_dosage(int x, int y, int a1, int a2, bool count_a2) {
+  if (x == 0 || y == 0) return -1;
+  int d;
+  if (a1 == 0) {
+    if (x != a2 || y != a2) return -1;
+    d = 0;
+  } else {
+    if ((x != a1 && x != a2) || (y != a1 && y != a2)) return -1;
+    d = static_cast<int>(x == a1) + static_cast<int>(y == a1);
+  }
+  return count_a2 ? 2 - d : d;
+}
+
+// Allele and genotype tallies of one marker, accumulated while streaming a
+// .ped file. Alleles get local codes 1, 2, ... in order of first appearance;
+// genotype counts are kept per unordered pair of local codes so PLINK's
+// effective counts need no second look at the genotypes.
+class PedMarkerTally {
+public:
+  // x, y: interned allele codes, 0 for missing.
+  void add(int x, int y) {
+    const int lx = x ? local(x) : 0;
+    const int ly = y ? local(y) : 0;
+    if (lx) counts_[lx - 1]++;
+    if (ly) counts_[ly - 1]++;
+    if (lx && ly) pairs_[pair_index(lx, ly)]++;
+  }
+
+  const std::vector<int>& counts() const { return counts_; }
+  int allele(int k) const { return k ? alleles_[k - 1] : 0; }
+
+  void effective_counts(int k1, int k2, int& c1, int& c2) const {
+    const int het = pairs_[pair_index(k1, k2)];
+    c1 = 2 * pairs_[pair_index(k1, k1)] + het;
+    c2 = 2 * pairs_[pair_index(k2, k2)] + het;
+  }
+
+private:
+  int local(int code) {
+    for (size_t k = 0; k < alleles_.size(); ++k) {
+      if (alleles_[k] == code) return (int)k + 1;
+    }
+    alleles_.push_back(code);
+    counts_.push_back(0);
+    // Triangular layout, larger code major: a new allele appends its row.
+    pairs_.resize(pairs_.size() + alleles_.size(), 0);
+    return (int)alleles_.size();
+  }
+
+  static size_t pair_index(int a, int b) {
+    const size_t lo = (size_t)std::min(a, b) - 1;
+    const size_t hi = (size_t)std::max(a, b) - 1;
+    return hi * (hi + 1) / 2 + lo;
+  }
+
+  std::vector<int> alleles_;
+  std::vector<int> counts_;
+  std::vector<int> pairs_;
+};
+
+// Whitespace-separated fields of one line of a text buffer.
+class FieldCursor {
+public:
+  FieldCursor(const char* begin, const char* end) : p_(begin), end_(end) {}
+
+  bool next(const char*& tok, int& len) {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r')) ++p_;
+    if (p_ == end_) return false;
+    tok = p_;
+    while (p_ < end_ && *p_ != ' ' && *p_ != '\t' && *p_ != '\r') ++p_;
+    len = (int)(p_ - tok);
+    return true;
+  }
+
+private:
+  const char* p_;
+  const char* end_;
+};
+
+// Calls f(line_begin, line_end) for every line of a text buffer.
+template <class F>
+void for_each_line(const char* p, const char* end, F f) {
+  while (p < end) {
+    const char* nl = static_cast<const char*>(std::memchr(p, '\n', (size_t)(end - p)));
+    const char* line_end = nl ? nl : end;
+    f(p, line_end);
+    p = nl ? nl + 1 : end;
+  }
+}
+
+// Interned code of a .ped allele token, upper-cased; 0 for PLINK's default
+// missing genotype code "0". To mirror plink/plinkR conversion, N/NA/-9 are
+// ordinary alleles here, and "." is kept as an allele distinct from missing
+// (it is written as "0" in the A1/A2 labels, see ped_output_label()).
+inline int ped_allele_code(const char* tok, int len, AlleleInterner& interner, std::string& buf) {
+  if (len == 1) {
+    const char c = (char)std::toupper((unsigned char)tok[0]);
+    return c == '0' ? 0 : interner.intern(c);
+  }
+  buf.assign(tok, (size_t)len);
+  for (size_t q = 0; q < buf.size(); ++q) buf[q] = (char)std::toupper((unsigned char)buf[q]);
+  return interner.intern(buf);
+}
+
+// ped_allele_code() for a character matrix cell borrowed by CellBlock (NULL
+// for NA), which may also carry surrounding whitespace.
+inline int ped_cell_code(const char* cell, AlleleInterner& interner, std::string& buf) {
+  if (cell == NULL) return 0;
+  const char* b = cell;
+  const char* e = cell + std::strlen(cell);
+  while (b < e && std::isspace((unsigned char)*b)) ++b;
+  while (e > b && std::isspace((unsigned char)e[-1])) --e;
+  if (b == e) return 0;
+  return ped_allele_code(b, (int)(e - b), interner, buf);
+}
+
+std::string ped_output_label(const AlleleInterner& interner, int code) {
+  if (code == 0) return "0";
+  const std::string& a = interner.label(code);
+  return a == "." ? std::string("0") : a;
+}
+
+#ifdef EB_USE_ZLIB
+// gzip output file fed in whole blocks. A background thread compresses and
+// writes one block while the caller fills the next (double buffering), so
+// deflate overlaps with producing rows instead of stalling it. The thread
+// never calls into R; failures are reported on the next write() or close().
+class BackgroundGzipFile {
+public:
+  explicit BackgroundGzipFile(const std::string& path)
+    : path_(path), gz_(gzopen(path.c_str(), "wb6")), has_block_(false), done_(false), failed_(false) {
+    if (!gz_) stop("Cannot open output file: " + path);
+    gzbuffer(gz_, 1 << 18);
+    worker_ = std::thread(&BackgroundGzipFile::run, this);
+  }
+
+  ~BackgroundGzipFile() {
+    finish();
+    if (gz_) gzclose(gz_);
+  }
+
+  BackgroundGzipFile(const BackgroundGzipFile&) = delete;
+  BackgroundGzipFile& operator=(const BackgroundGzipFile&) = delete;
+
+  // Hands a filled block to the compressor; `block` comes back empty (with
+  // the capacity of an earlier block) for refilling.
+  void write(std::vector<char>& block) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_.wait(lock, [this] { return !has_block_; });
+      pending_.swap(block);
+      has_block_ = true;
+    }
+    ready_.notify_one();
+    block.clear();
+    if (failed_) stop("Error writing file: " + path_);
+  }
+
+  void close() {
+    finish();
+    const int rc = gzclose(gz_);
+    gz_ = NULL;
+    if (failed_ || rc != Z_OK) stop("Error writing file: " + path_);
+  }
+
+private:
+  void finish() {
+    if (!worker_.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    ready_.notify_one();
+    worker_.join();
+  }
+
+  void run() {
+    std::vector<char> work;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this] { return has_block_ || done_; });
+        if (!has_block_) return;
+        work.swap(pending_);
+        has_block_ = false;
+      }
+      idle_.notify_one();
+      if (!failed_ && !work.empty() &&
+          gzwrite(gz_, work.data(), (unsigned)work.size()) != (int)work.size()) {
+        failed_ = true;
+      }
+      work.clear();
+    }
+  }
+
+  std::string path_;
+  gzFile gz_;
+  std::vector<char> pending_;
+  bool has_block_;
+  bool done_;
+  std::atomic<bool> failed_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable idle_;
+  std::thread worker_;
+};
+#endif
+
+// compress argument of the BLUPF90 writers: "none" or "gzip".
+bool parse_gzip(const std::string& compress) {
+  if (compress == "none" || compress.empty()) return false;
+  if (compress == "gzip" || compress == "gz") {
+#ifndef EB_USE_ZLIB
+    stop("gzip output needs easybreedeR built with zlib (EB_USE_ZLIB, see Makevars)");
+#endif
+    return true;
+  }
+  stop("compress must be \"none\" or \"gzip\"");
+  return false;
 }
 
-double hwe_exact_pvalue_local(int obs_hets, int obs_hom1, int obs_hom2) {
-  int obs_homr = std::min(obs_hom1, obs_hom2);
-  int obs_homc = std::max(obs_hom1, obs_hom2);
-  int rare_copies = 2 * obs_homr + obs_hets;
-  int genotypes = obs_hets + obs_homc + obs_homr;
-  if (genotypes <= 0) return NA_REAL;
+// Buffered writer for BLUPF90 genotype text files ("continuous" format): one
+// line per animal with the ID, a space and one 0/1/2/5 character per marker. IDs shorter than id_width are padded
+// with spaces so that every genotype string starts in the same column. With
+// gzip the blocks are compressed on a background thread.
+class BlupTextWriter {
+public:
+  BlupTextWriter(const std::string& path, size_t id_width, bool gzip)
+    : path_(path), fp_(NULL), id_width_(id_width) {
+    if (gzip) {
+#ifdef EB_USE_ZLIB
+      gz_.reset(new BackgroundGzipFile(path));
+#endif
+    } else {
+      fp_ = std::fopen(path.c_str(), "wb");
+      if (!fp_) stop("Cannot open output file: " + path);
+    }
+    buf_.reserve(BUFFER_BYTES);
+  }
+
+  ~BlupTextWriter() {
+    if (fp_) std::fclose(fp_);
+  }
+
+  BlupTextWriter(const BlupTextWriter&) = delete;
+  BlupTextWriter& operator=(const BlupTextWriter&) = delete;
+
+  void write_row(const std::string& id, const char* codes, size_t m) {
+    append(id.data(), id.size());
+    for (size_t k = id.size(); k < id_width_; ++k) append(" ", 1);
+    append(" ", 1);
+    append(codes, m);
+    append("\n", 1);
+  }
+
+  void close() {
+    flush();
+#ifdef EB_USE_ZLIB
+    if (gz_) {
+      gz_->close();
+      return;
+    }
+#endif
+    const int rc = std::fclose(fp_);
+    fp_ = NULL;
+    if (rc != 0) stop("Error writing file: " + path_);
+  }
+
+private:
+  static const size_t BUFFER_BYTES = (size_t)4 << 20;
 
-  std::vector<double> probs(rare_copies + 1, 0.0);
-  int mid = (int) std::floor((double)rare_copies * (2.0 * genotypes - rare_copies) / (2.0 * genotypes));
-  if ((rare_copies & 1) != (mid & 1)) mid++;
+  void append(const char* p, size_t len) {
+    while (len > 0) {
+      if (buf_.size() == BUFFER_BYTES) flush();
+      const size_t k = std::min(len, BUFFER_BYTES - buf_.size());
+      buf_.insert(buf_.end(), p, p + k);
+      p += k;
+      len -= k;
+    }
+  }
 
-  int curr_hets = mid;
-  int curr_homr = (rare_copies - mid) / 2;
-  int curr_homc = genotypes - curr_hets - curr_homr;
+  void flush() {
+#ifdef EB_USE_ZLIB
+    if (gz_) {
+      gz_->write(buf_);
+      buf_.reserve(BUFFER_BYTES);
+      return;
+    }
+#endif
+    if (!buf_.empty() && std::fwrite(buf_.data(), 1, buf_.size(), fp_) != buf_.size()) {
+      stop("Error writing file: " + path_);
+    }
+    buf_.clear();
+  }
 
-  probs[mid] = 1.0;
-  double sum = probs[mid];
+  std::string path_;
+  std::FILE* fp_;
+  size_t id_width_;
+  std::vector<char> buf_;
+#ifdef EB_USE_ZLIB
+  std::unique_ptr<BackgroundGzipFile> gz_;
+#endif
+};
+
+// Writes a BLUPF90 genotype file for ids.size() animals and m markers.
+// fill(s0, s1, rows) stores the characters of animals [s0, s1) in rows, m per
+// animal. Blocks of about 64 MB start at a multiple of 4 animals, so packed
+// sources start on a byte. fixed_width pads IDs to the longest one; gzip
+// compresses the output.
+template <class Fill>
+void write_blup_txt(const std::string& path, const std::vector<std::string>& ids, int m,
+                    bool fixed_width, bool gzip, const Fill& fill) {
+  const int n = (int)ids.size();
+  size_t id_width = 0;
+  if (fixed_width) {
+    for (int i = 0; i < n; ++i) id_width = std::max(id_width, ids[i].size());
+  }
+  const size_t block_bytes = (size_t)64 << 20;
+  int block = (int)std::min<size_t>((size_t)n, std::max<size_t>(4, block_bytes / (size_t)std::max(m, 1)));
+  block = std::max(4, block & ~3);
+  std::vector<char> rows((size_t)std::min(block, n) * (size_t)m);
+  BlupTextWriter txt(path, id_width, gzip);
+  for (int s0 = 0; s0 < n; s0 += block) {
+    const int s1 = std::min(n, s0 + block);
+    fill(s0, s1, rows.data());
+    for (int i = s0; i < s1; ++i) txt.write_row(ids[i], rows.data() + (size_t)(i - s0) * m, (size_t)m);
+    Rcpp::checkUserInterrupt();
+  }
+  txt.close();
+}
 
-  while (curr_hets > 1) {
-    double p = probs[curr_hets] * curr_hets * (curr_hets - 1.0) /
-      (4.0 * (curr_homr + 1.0) * (curr_homc + 1.0));
-    probs[curr_hets - 2] = p;
-    sum += p;
-    curr_hets -= 2;
-    curr_homr += 1;
-    curr_homc += 1;
+// Row characters from a 2-bit packed store or .bed body; code_chars[c] is the
+// character for 2-bit code c. Four genotypes are decoded per byte.
+class PackedRowFill {
+public:
+  PackedRowFill(const gvr::PackedGenotypes& g, const char* code_chars) : g_(g), byte_chars_(256 * 4) {
+    for (int b = 0; b < 256; ++b) {
+      for (int k = 0; k < 4; ++k) byte_chars_[4 * b + k] = code_chars[(b >> (2 * k)) & 3];
+    }
+  }
+
+  void operator()(int s0, int s1, char* rows) const {
+    const int m = g_.n_markers();
+    const int b0 = s0 >> 2;
+    const int b1 = (s1 + 3) >> 2;
+    for (int j = 0; j < m; ++j) {
+      const unsigned char* col = g_.marker(j);
+      char* out = rows + j;
+      for (int b = b0; b < b1; ++b) {
+        const char* chars = byte_chars_.data() + 4 * col[b];
+        const int i0 = 4 * b - s0;
+        const int k1 = std::min(4, s1 - 4 * b);
+        for (int k = 0; k < k1; ++k) out[(size_t)(i0 + k) * m] = chars[k];
+      }
+    }
+  }
+
+private:
+  const gvr::PackedGenotypes& g_;
+  std::vector<char> byte_chars_;
+};
+
+// Row characters from a samples x markers integer, double or raw dosage
+// matrix; any value other than 0, 1 or 2 is written as the missing code 5.
+class MatrixRowFill {
+public:
+  explicit MatrixRowFill(SEXP x)
+    : n_(Rf_nrows(x)), m_(Rf_ncols(x)),
+      int_(TYPEOF(x) == INTSXP ? INTEGER(x) : NULL),
+      real_(TYPEOF(x) == REALSXP ? REAL(x) : NULL),
+      raw_(TYPEOF(x) == RAWSXP ? RAW(x) : NULL) {
+    if (!int_ && !real_ && !raw_) stop("dosage must be an integer, numeric or raw matrix, or a packed store");
+  }
+
+  void operator()(int s0, int s1, char* rows) const {
+    for (int j = 0; j < m_; ++j) {
+      const size_t off = (size_t)j * (size_t)n_;
+      char* out = rows + j;
+      for (int i = s0; i < s1; ++i) {
+        char c = '5';
+        if (int_) {
+          const int v = int_[off + i];
+          if (v >= 0 && v <= 2) c = (char)('0' + v);
+        } else if (real_) {
+          const double v = real_[off + i];
+          if (v == 0 || v == 1 || v == 2) c = (char)('0' + (int)v);
+        } else {
+          const Rbyte v = raw_[off + i];
+          if (v <= 2) c = (char)('0' + v);
+        }
+        out[(size_t)(i - s0) * m_] = c;
+      }
+    }
   }
 
-  curr_hets = mid;
-  curr_homr = (rare_copies - mid) / 2;
-  curr_homc = genotypes - curr_hets - curr_homr;
-  while (curr_hets <= rare_copies - 2) {
-    double p = probs[curr_hets] * 4.0 * curr_homr * curr_homc /
-      ((curr_hets + 2.0) * (curr_hets + 1.0));
-    probs[curr_hets + 2] = p;
-    sum += p;
-    curr_hets += 2;
-    curr_homr -= 1;
-    curr_homc -= 1;
+private:
+  int n_;
+  int m_;
+  const int* int_;
+  const double* real_;
+  const Rbyte* raw_;
+};
+
+// BLUPF90 .map chromosome handling shared with the R converters: chromosome
+// "0" is written as the largest positive numeric chromosome (40 if none).
+double blup_max_chr(const std::vector<std::string>& chr) {
+  double max_chr = 0;
+  bool any = false;
+  for (size_t k = 0; k < chr.size(); ++k) {
+    char* end = NULL;
+    const double v = std::strtod(chr[k].c_str(), &end);
+    if (end == chr[k].c_str() || *end != '\0' || !std::isfinite(v) || v <= 0) continue;
+    if (!any || v > max_chr) max_chr = v;
+    any = true;
   }
+  return any ? max_chr : 40;
+}
+
+bool is_zero_chr(const std::string& chr) {
+  char* end = NULL;
+  const double v = std::strtod(chr.c_str(), &end);
+  return end != chr.c_str() && *end == '\0' && v == 0;
+}
 
-  if (!(obs_hets >= 0 && obs_hets <= rare_copies)) return NA_REAL;
-  if (sum <= 0.0) return NA_REAL;
-  for (int i = 0; i <= rare_copies; ++i) probs[i] /= sum;
+std::string format_chr(double chr) {
+  char buf[32];
+  if (chr == std::floor(chr) && std::fabs(chr) < 1e15) {
+    std::snprintf(buf, sizeof(buf), "%.0f", chr);
+  } else {
+    std::snprintf(buf, sizeof(buf), "%.15g", chr);
+  }
+  return buf;
+}
 
-  double p_obs = probs[obs_hets];
-  double p_hwe = 0.0;
-  for (int i = (rare_copies & 1); i <= rare_copies; i += 2) {
-    if (probs[i] <= p_obs + 1e-12) p_hwe += probs[i];
+void write_blup_map(const std::string& path, const gvr::BimData& bim, double max_chr) {
+  std::ofstream out(path.c_str(), std::ios::binary);
+  if (!out) stop("Cannot open output file: " + path);
+  const std::string zero_chr = format_chr(max_chr);
+  for (int j = 0; j < bim.size(); ++j) {
+    out << (is_zero_chr(bim.chr[j]) ? zero_chr : bim.chr[j]) << '\t' << bim.snp[j] << '\t'
+        << bim.cm[j] << '\t' << bim.bp[j] << '\n';
   }
-  if (p_hwe > 1.0) p_hwe = 1.0;
-  return p_hwe;
+  out.close();
+  if (!out) stop("Error writing file: " + path);
+}
+
+bool same_file(const std::string& a, const std::string& b) {
+  if (a == b) return true;
+#ifndef _WIN32
+  struct stat sa, sb;
+  return ::stat(a.c_str(), &sa) == 0 && ::stat(b.c_str(), &sb) == 0 &&
+         sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#else
+  return false;
+#endif
+}
+
+void copy_file(const std::string& from, const std::string& to) {
+  if (same_file(from, to)) return;
+  std::ifstream in(from.c_str(), std::ios::binary);
+  if (!in) stop("Cannot open file: " + from);
+  std::ofstream out(to.c_str(), std::ios::binary);
+  if (!out) stop("Cannot open output file: " + to);
+  out << in.rdbuf();
+  out.close();
+  if (!out) stop("Error writing file: " + to);
 }
 
 } // namespace
@@ -133,9 +854,15 @@ double hwe_exact_pvalue_local(int obs_hets, int obs_hom1, int obs_hom2) {
 // Convert PED allele pairs to PLINK-style additive coding for BLUPF90.
 // - dosage: 0/1/2 for A1 copies, 5 for missing/unusable
 // - a1/a2: PLINK-like minor/major allele labels for each marker
+// output = "raw" or "packed" returns the dosage in 1 byte or 2 bits per
+// genotype instead of an integer matrix (see DosageSink).
+// Markers are independent, so blocks of markers are coded on n_threads
+// workers, each writing its own output columns; results do not depend on
+// the number of threads.
 // [[Rcpp::export]]
 List eb_ped_to_blup_codes_cpp(CharacterMatrix allele1, CharacterMatrix allele2,
-                              std::string counted_allele = "A1") {
+                              std::string counted_allele = "A1", std::string output = "integer",
+                              int n_threads = 0) {
   const int n_samples = allele1.nrow();
   const int n_markers = allele1.ncol();
   if (allele2.nrow() != n_samples || allele2.ncol() != n_markers) {
@@ -149,163 +876,309 @@ List eb_ped_to_blup_codes_cpp(CharacterMatrix allele1, CharacterMatrix allele2,
   }
   const bool count_a2 = (counted_allele == "A2");
 
-  IntegerMatrix dosage(n_samples, n_markers);
-  CharacterVector a1_out(n_markers);
-  CharacterVector a2_out(n_markers);
-
-  for (int j = 0; j < n_markers; ++j) {
-    std::unordered_map<std::string, int> allele_count;
-    std::unordered_map<std::string, int> first_seen;
-    int seen_rank = 0;
-
+  n_threads = gvr::resolve_threads(n_threads);
+  DosageSink dosage(output, n_samples, n_markers);
+  std::vector<signed char> cols((size_t)n_threads * (size_t)n_samples);
+  std::vector<std::string> a1_labels(n_markers);
+  std::vector<std::string> a2_labels(n_markers);
+  std::vector<AlleleInterner> interners(n_threads);
+  std::vector<std::vector<int>> thread_counts(n_threads);
+  std::vector<int> thread_codes((size_t)n_threads * 2 * (size_t)n_samples);
+  std::vector<std::string> bufs(n_threads);
+
+  CellBlock cells1(allele1);
+  CellBlock cells2(allele2);
+  gvr::parallel_marker_blocks(n_markers, n_threads,
+                              [&](int start, int end) {
+                                cells1.load(start, end);
+                                cells2.load(start, end);
+                              },
+                              [&](int j, int t) {
+    signed char* col = cols.data() + (size_t)t * (size_t)n_samples;
+    int* codes = thread_codes.data() + (size_t)t * 2 * (size_t)n_samples;
+    AlleleInterner& interner = interners[t];
+    std::vector<int>& counts = thread_counts[t];
+    std::string& buf = bufs[t];
+    interner.clear();
+    counts.clear();
+
+    // Normalise every allele once; the later passes only compare codes.
     for (int i = 0; i < n_samples; ++i) {
-      const std::string a = normalize_allele_for_plink_ped(allele1(i, j));
-      const std::string b = normalize_allele_for_plink_ped(allele2(i, j));
-
-      if (!is_missing_allele_plink_ped_default(a)) {
-        if (first_seen.find(a) == first_seen.end()) {
-          first_seen[a] = seen_rank++;
-        }
-        ++allele_count[a];
+      const int x = ped_cell_code(cells1(i, j), interner, buf);
+      const int y = ped_cell_code(cells2(i, j), interner, buf);
+      codes[2 * i] = x;
+      codes[2 * i + 1] = y;
+      if (x) {
+        if (x > (int)counts.size()) counts.push_back(0);
+        ++counts[x - 1];
       }
-      if (!is_missing_allele_plink_ped_default(b)) {
-        if (first_seen.find(b) == first_seen.end()) {
-          first_seen[b] = seen_rank++;
-        }
-        ++allele_count[b];
+      if (y) {
+        if (y > (int)counts.size()) counts.push_back(0);
+        ++counts[y - 1];
       }
     }
 
-    std::vector<std::pair<std::string, int>> alleles;
-    alleles.reserve(allele_count.size());
-    for (const auto& kv : allele_count) {
-      alleles.push_back(kv);
-    }
-
-    std::sort(alleles.begin(), alleles.end(), [&](const std::pair<std::string, int>& lhs,
-                                                  const std::pair<std::string, int>& rhs) {
-      if (lhs.second != rhs.second) {
-        return lhs.second > rhs.second; // larger count first
-      }
-      return first_seen[lhs.first] < first_seen[rhs.first]; // first observed first
-    });
-
-    std::string a1 = "0";
-    std::string a2 = "0";
-    if (alleles.empty()) {
-      a1 = "0";
-      a2 = "0";
-    } else if (alleles.size() == 1) {
-      // Match PLINK convention for monomorphic variants: A1=0, A2=observed allele.
-      a1 = "0";
-      a2 = alleles[0].first;
-    } else {
-      const std::string keep1 = alleles[0].first;
-      const std::string keep2 = alleles[1].first;
-
-      // PLINK assigns A1/A2 after rare alleles are dropped and any genotype
-      // carrying a dropped allele becomes missing. This can change the effective
-      // minor/major ordering compared with the raw per-allele counts.
-      int keep1_eff_count = 0;
-      int keep2_eff_count = 0;
-      for (int i = 0; i < n_samples; ++i) {
-        const std::string x = normalize_allele_for_plink_ped(allele1(i, j));
-        const std::string y = normalize_allele_for_plink_ped(allele2(i, j));
-        if (is_missing_allele_plink_ped_default(x) || is_missing_allele_plink_ped_default(y)) {
-          continue;
-        }
-        const bool x_known = (x == keep1 || x == keep2);
-        const bool y_known = (y == keep1 || y == keep2);
-        if (!x_known || !y_known) {
-          continue;
-        }
-        keep1_eff_count += static_cast<int>(x == keep1) + static_cast<int>(y == keep1);
-        keep2_eff_count += static_cast<int>(x == keep2) + static_cast<int>(y == keep2);
-      }
-
-      if (keep1_eff_count == 0 && keep2_eff_count == 0) {
-        // Pathological corner case; fall back to pre-drop counts to keep output deterministic.
-        keep1_eff_count = alleles[0].second;
-        keep2_eff_count = alleles[1].second;
-      }
-
-      if (keep1_eff_count == keep2_eff_count) {
-        // If post-pruning effective counts tie, PLINK keeps the preselected
-        // top-two order (A1=second, A2=top) instead of re-breaking the tie by
-        // first-seen rank on the pruned counts.
-        a1 = keep2;
-        a2 = keep1;
-      } else {
-        // A1 is minor, A2 is major.
-        if (keep1_eff_count < keep2_eff_count) {
-          a1 = keep1;
-          a2 = keep2;
-        } else {
-          a1 = keep2;
-          a2 = keep1;
-        }
-      }
-    }
-
-    a1_out[j] = plink_ped_output_allele_label(a1);
-    a2_out[j] = plink_ped_output_allele_label(a2);
+    int a1 = 0;
+    int a2 = 0;
+    plink_ped_a1_a2(counts,
+                    [codes, n_samples](int k1, int k2, int& c1, int& c2) {
+                      for (int i = 0; i < n_samples; ++i) {
+                        const int x = codes[2 * i];
+                        const int y = codes[2 * i + 1];
+                        if ((x != k1 && x != k2) || (y != k1 && y != k2)) continue;
+                        c1 += static_cast<int>(x == k1) + static_cast<int>(y == k1);
+                        c2 += static_cast<int>(x == k2) + static_cast<int>(y == k2);
+                      }
+                    },
+                    a1, a2);
+    a1_labels[j] = ped_output_label(interner, a1);
+    a2_labels[j] = ped_output_label(interner, a2);
 
     for (int i = 0; i < n_samples; ++i) {
-      const std::string x = normalize_allele_for_plink_ped(allele1(i, j));
-      const std::string y = normalize_allele_for_plink_ped(allele2(i, j));
+      col[i] = (signed char)blup_dosage(codes[2 * i], codes[2 * i + 1], a1, a2, count_a2);
+    }
+    dosage.put(j, col);
+  });
 
-      if (is_missing_allele_plink_ped_default(x) || is_missing_allele_plink_ped_default(y)) {
-        dosage(i, j) = 5;
-        continue;
-      }
+  CharacterVector a1_out(n_markers);
+  CharacterVector a2_out(n_markers);
+  for (int j = 0; j < n_markers; ++j) {
+    a1_out[j] = a1_labels[j];
+    a2_out[j] = a2_labels[j];
+  }
 
-      if (a1 == "0") {
-        // Monomorphic: valid non-missing genotype, zero copies of A1.
-        if (x == a2 && y == a2) {
-          dosage(i, j) = 0;
-        } else {
-          dosage(i, j) = 5;
-        }
-        continue;
-      }
+  return List::create(
+    _["dosage"] = dosage.result(),
+    _["a1"] = a1_out,
+    _["a2"] = a2_out,
+    _["counted_allele"] = counted_allele
+  );
+}
 
-      const bool x_known = (x == a1 || x == a2);
-      const bool y_known = (y == a1 || y == a2);
-      if (!x_known || !y_known) {
-        // Additional alleles are treated as missing in the fallback path.
-        dosage(i, j) = 5;
-        continue;
-      }
+// eb_ped_to_blup_codes_cpp() straight from a .ped/.map file pair. The .ped
+// file is memory-mapped and read twice, tokenising alleles in place: the
+// first pass tallies alleles per marker, the second writes dosages into the
+// output. No R strings are created for genotypes, so peak memory is the
+// dosage output plus a few small tallies per marker. Also returns the sample
+// IDs (.ped column 2) and the .map columns.
+// [[Rcpp::export]]
+List eb_ped_file_to_blup_codes_cpp(std::string ped_path, std::string map_path,
+                                   std::string counted_allele = "A1",
+                                   std::string output = "integer") {
+  counted_allele = upper_copy(trim_copy(counted_allele));
+  if (counted_allele.empty()) counted_allele = "A1";
+  if (counted_allele != "A1" && counted_allele != "A2") {
+    stop("counted_allele must be 'A1' or 'A2'");
+  }
+  const bool count_a2 = (counted_allele == "A2");
 
-      int d = static_cast<int>(x == a1) + static_cast<int>(y == a1);
-      if (count_a2) d = 2 - d;
-      dosage(i, j) = d;
+  std::vector<std::string> chr, snp, cm, bp;
+  {
+    std::ifstream in(map_path.c_str());
+    if (!in) stop("Cannot open .map file: " + map_path);
+    std::string line;
+    std::vector<std::string> f;
+    while (std::getline(in, line)) {
+      const int nf = gvr::split_fields(line, f);
+      if (nf == 0) continue;
+      if (nf < 4) stop("Invalid .map file: need at least 4 columns and >=1 marker row.");
+      chr.push_back(f[0]);
+      snp.push_back(f[1]);
+      cm.push_back(f[2]);
+      bp.push_back(f[3]);
     }
-
-    if (count_a2 && a1 == "0") {
-      // Preserve PLINK2-style A2-count flip behavior for monomorphic variants:
-      // valid A2/A2 genotypes become 2 instead of 0 (missing remains 5).
-      for (int i = 0; i < n_samples; ++i) {
-        if (dosage(i, j) != 5) dosage(i, j) = 2 - dosage(i, j);
+  }
+  const int n_markers = (int)snp.size();
+  if (n_markers == 0) stop("Invalid .map file: need at least 4 columns and >=1 marker row.");
+  const int expected_cols = 6 + 2 * n_markers;
+
+  gvr::MappedFile ped(ped_path);
+  const char* begin = reinterpret_cast<const char*>(ped.data());
+  const char* end = begin + ped.size();
+
+  AlleleInterner interner;
+  std::string buf;
+  std::vector<PedMarkerTally> tallies(n_markers);
+  std::vector<std::string> sample_id;
+
+  // Pass 1: sample IDs, column checks and per-marker allele tallies.
+  int line_no = 0;
+  for_each_line(begin, end, [&](const char* p, const char* line_end) {
+    ++line_no;
+    FieldCursor fields(p, line_end);
+    const char* tok;
+    int len;
+    int col = 0;
+    for (; col < 6 && fields.next(tok, len); ++col) {
+      if (col == 1) sample_id.push_back(std::string(tok, (size_t)len));
+    }
+    if (col == 0) return;
+    for (int j = 0; j < n_markers; ++j) {
+      const char* tok_b;
+      int len_b;
+      if (!fields.next(tok, len) || !fields.next(tok_b, len_b)) {
+        stop("PED/MAP mismatch: .ped line " + std::to_string(line_no) + " has fewer than " +
+             std::to_string(expected_cols) + " columns for " + std::to_string(n_markers) + " markers.");
       }
+      tallies[j].add(ped_allele_code(tok, len, interner, buf),
+                     ped_allele_code(tok_b, len_b, interner, buf));
     }
+    if ((line_no & 1023) == 0) Rcpp::checkUserInterrupt();
+  });
+  const int n_samples = (int)sample_id.size();
+  if (n_samples == 0) stop("Invalid .ped file: need >=7 columns and >=1 sample row.");
+
+  std::vector<int> a1(n_markers), a2(n_markers);
+  CharacterVector a1_out(n_markers);
+  CharacterVector a2_out(n_markers);
+  for (int j = 0; j < n_markers; ++j) {
+    const PedMarkerTally& tally = tallies[j];
+    int k1 = 0;
+    int k2 = 0;
+    plink_ped_a1_a2(tally.counts(),
+                    [&tally](int x, int y, int& cx, int& cy) { tally.effective_counts(x, y, cx, cy); },
+                    k1, k2);
+    a1[j] = tally.allele(k1);
+    a2[j] = tally.allele(k2);
+    a1_out[j] = ped_output_label(interner, a1[j]);
+    a2_out[j] = ped_output_label(interner, a2[j]);
   }
+  std::vector<PedMarkerTally>().swap(tallies);
+
+  // Pass 2: dosages, one sample row at a time.
+  DosageSink dosage(output, n_samples, n_markers);
+  int i = 0;
+  for_each_line(begin, end, [&](const char* p, const char* line_end) {
+    FieldCursor fields(p, line_end);
+    const char* tok;
+    int len;
+    int col = 0;
+    while (col < 6 && fields.next(tok, len)) ++col;
+    if (col == 0) return;
+    for (int j = 0; j < n_markers; ++j) {
+      const char* tok_b;
+      int len_b;
+      fields.next(tok, len);
+      fields.next(tok_b, len_b);
+      const int x = ped_allele_code(tok, len, interner, buf);
+      const int y = ped_allele_code(tok_b, len_b, interner, buf);
+      dosage.set(i, j, (signed char)blup_dosage(x, y, a1[j], a2[j], count_a2));
+    }
+    ++i;
+    if ((i & 1023) == 0) Rcpp::checkUserInterrupt();
+  });
 
   return List::create(
-    _["dosage"] = dosage,
+    _["dosage"] = dosage.result(),
     _["a1"] = a1_out,
     _["a2"] = a2_out,
-    _["counted_allele"] = counted_allele
+    _["counted_allele"] = counted_allele,
+    _["sample_id"] = wrap(sample_id),
+    _["chr"] = wrap(chr),
+    _["snp"] = wrap(snp),
+    _["cm"] = wrap(cm),
+    _["bp"] = wrap(bp)
+  );
+}
+
+// PLINK .bed/.bim/.fam fileset to BLUPF90 files without PLINK or snpStats:
+// <out_prefix>.txt (IID, a space, one 0/1/2/5 character per marker),
+// <out_prefix>.map (chromosome 0 written as the largest numeric chromosome)
+// and <out_prefix>.bim (a copy of the input .bim). Dosages count A1 copies,
+// or A2 copies with counted_allele = "A2", as eb_ped_to_blup_codes_cpp()
+// does; fixed_width pads IDs so genotypes start in one column. The .bed is
+// memory-mapped and transposed to animal rows in blocks of samples.
+// compress = "gzip" writes <out_prefix>.txt.gz instead, compressed on a
+// background thread.
+// [[Rcpp::export]]
+List eb_bed_to_blupf90_cpp(std::string bed_path, std::string bim_path, std::string fam_path,
+                           std::string out_prefix, std::string counted_allele = "A1",
+                           bool fixed_width = true, std::string compress = "none") {
+  counted_allele = upper_copy(trim_copy(counted_allele));
+  if (counted_allele.empty()) counted_allele = "A1";
+  if (counted_allele != "A1" && counted_allele != "A2") {
+    stop("counted_allele must be 'A1' or 'A2'");
+  }
+  const bool gzip = parse_gzip(compress);
+
+  gvr::FamData fam;
+  gvr::BimData bim;
+  gvr::read_fam(fam_path, fam);
+  gvr::read_bim(bim_path, bim);
+  const int n = fam.size();
+  const int m = bim.size();
+  if (n == 0) stop("Input .fam file has no samples: " + fam_path);
+  if (m == 0) stop("Input .bim file has no markers: " + bim_path);
+  std::unique_ptr<const gvr::PackedGenotypes> bed(gvr::map_bed(bed_path, n, m));
+
+  const std::string out_txt = out_prefix + (gzip ? ".txt.gz" : ".txt");
+  const std::string out_map = out_prefix + ".map";
+  const std::string out_bim = out_prefix + ".bim";
+
+  // .bed 2-bit codes: 00 hom A1, 01 missing, 10 het, 11 hom A2.
+  write_blup_txt(out_txt, fam.iid, m, fixed_width, gzip,
+                 PackedRowFill(*bed, counted_allele == "A1" ? "2510" : "0512"));
+
+  const double max_chr = blup_max_chr(bim.chr);
+  write_blup_map(out_map, bim, max_chr);
+  copy_file(bim_path, out_bim);
+
+  return List::create(
+    _["txt"] = out_txt,
+    _["map"] = out_map,
+    _["bim"] = out_bim,
+    _["max_chr"] = max_chr,
+    _["counted_allele"] = counted_allele,
+    _["n_samples"] = n,
+    _["n_markers"] = m
   );
 }
 
+// Writes a BLUPF90 genotype file from a dosage matrix (samples x markers;
+// integer, double or raw, as returned by eb_ped_to_blup_codes_cpp()) or a
+// packed store: one line per animal with its ID and one 0/1/2/5 character per
+// marker, through a large output buffer. fixed_width pads IDs to the longest
+// so that genotypes start in the same column; compress = "gzip" writes a
+// gzip file, compressed on a background thread.
+// [[Rcpp::export]]
+std::string eb_write_blupf90_txt_cpp(SEXP dosage, CharacterVector sample_id, std::string path,
+                                     bool fixed_width = true, std::string compress = "none") {
+  const bool gzip = parse_gzip(compress);
+  std::vector<std::string> ids(sample_id.size());
+  for (R_xlen_t k = 0; k < sample_id.size(); ++k) ids[k] = CHAR(STRING_ELT(sample_id, k));
+  if (gvr::is_packed_genotypes(dosage)) {
+    const gvr::PackedGenotypes& g = gvr::packed_genotypes(dosage);
+    if (g.n_samples() != (int)ids.size()) stop("sample_id must have one entry per row of dosage");
+    // Packed dosage stores hold the dosage itself: 00 = 2, 01 = missing, 10 = 1, 11 = 0.
+    write_blup_txt(path, ids, g.n_markers(), fixed_width, gzip, PackedRowFill(g, "2510"));
+    return path;
+  }
+  if (!Rf_isMatrix(dosage)) stop("dosage must be a matrix or a packed store");
+  if (Rf_nrows(dosage) != (int)ids.size()) stop("sample_id must have one entry per row of dosage");
+  write_blup_txt(path, ids, Rf_ncols(dosage), fixed_width, gzip, MatrixRowFill(dosage));
+  return path;
+}
+
+// Encodes PED-style genotype strings once (two allele codes per cell plus
+// per-marker allele dictionaries). The *_from_ped_strings functions accept
+// the result in place of the character matrix, so computing several
+// statistics parses the strings only once.
+// [[Rcpp::export]]
+SEXP gvr_encode_ped_strings(CharacterMatrix geno_pairs, int n_threads = 0) {
+  Rcpp::XPtr<PedEncoding> ptr(encode_ped_strings(geno_pairs, gvr::resolve_threads(n_threads)), true);
+  ptr.attr("class") = PED_ENCODING_CLASS;
+  return ptr;
+}
+
 // PLINK-aligned call-rate calculation directly from PED-style genotype strings.
 // Input matrix cells are expected like "A T", "0 0", "na na", etc.
 // Missing if either allele is missing code after trim+toupper.
 // [[Rcpp::export]]
-List gvr_call_rate_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
-  const int n = geno_pairs.nrow();
-  const int m = geno_pairs.ncol();
+List gvr_call_rate_from_ped_strings_cpp(SEXP geno_pairs, int n_threads = 0) {
+  std::unique_ptr<PedEncoding> owned;
+  const PedEncoding& enc = ped_encoding(geno_pairs, gvr::resolve_threads(n_threads), owned);
+  const int n = enc.n_samples();
+  const int m = enc.n_markers();
   NumericVector marker_call_rate(m, NA_REAL);
   NumericVector individual_call_rate(n, NA_REAL);
 
@@ -316,22 +1189,19 @@ List gvr_call_rate_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
     );
   }
 
-  std::vector<int> marker_non_missing(m, 0);
-  for (int i = 0; i < n; ++i) {
-    int individual_non_missing = 0;
-    for (int j = 0; j < m; ++j) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (is_missing_allele(a) || is_missing_allele(b)) continue;
-      individual_non_missing++;
-      marker_non_missing[j]++;
+  std::vector<int> individual_non_missing(n, 0);
+  for (int j = 0; j < m; ++j) {
+    const unsigned char* codes = enc.marker(j);
+    int marker_non_missing = 0;
+    for (int i = 0; i < n; ++i) {
+      const int called = codes[2 * i] != 0 && codes[2 * i + 1] != 0;
+      marker_non_missing += called;
+      individual_non_missing[i] += called;
     }
-    individual_call_rate[i] = static_cast<double>(individual_non_missing) / static_cast<double>(m);
+    marker_call_rate[j] = static_cast<double>(marker_non_missing) / static_cast<double>(n);
   }
-
-  for (int j = 0; j < m; ++j) {
-    marker_call_rate[j] = static_cast<double>(marker_non_missing[j]) / static_cast<double>(n);
+  for (int i = 0; i < n; ++i) {
+    individual_call_rate[i] = static_cast<double>(individual_non_missing[i]) / static_cast<double>(m);
   }
 
   return List::create(
@@ -344,148 +1214,78 @@ List gvr_call_rate_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
 // Missing rules match gvr_call_rate_from_ped_strings_cpp.
 // For loci with >2 observed alleles, keep top-2 alleles by count and treat others as missing.
 // [[Rcpp::export]]
-NumericVector gvr_maf_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
-  const int n = geno_pairs.nrow();
-  const int m = geno_pairs.ncol();
+NumericVector gvr_maf_from_ped_strings_cpp(SEXP geno_pairs, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  std::unique_ptr<PedEncoding> owned;
+  const PedEncoding& enc = ped_encoding(geno_pairs, n_threads, owned);
+  const int n = enc.n_samples();
+  const int m = enc.n_markers();
   NumericVector maf(m, NA_REAL);
   if (n == 0 || m == 0) return maf;
-
-  for (int j = 0; j < m; ++j) {
-    std::unordered_map<std::string, int> allele_count;
-    std::unordered_map<std::string, int> first_seen;
-    int seen_rank = 0;
-
-    for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (!is_missing_allele(a)) {
-        if (first_seen.find(a) == first_seen.end()) first_seen[a] = seen_rank++;
-        allele_count[a]++;
-      }
-      if (!is_missing_allele(b)) {
-        if (first_seen.find(b) == first_seen.end()) first_seen[b] = seen_rank++;
-        allele_count[b]++;
-      }
-    }
-
-    if (allele_count.empty()) {
-      maf[j] = NA_REAL;
-      continue;
+  double* maf_p = maf.begin();
+
+  gvr::parallel_markers(m, n_threads, [&](int j, int) {
+    int major = 0, minor = 0;
+    enc.top_two(j, major, minor);
+    if (major == 0) return;
+    if (minor == 0) {
+      maf_p[j] = 0.0;
+      return;
     }
-    if (allele_count.size() == 1) {
-      maf[j] = 0.0;
-      continue;
-    }
-
-    std::vector<std::pair<std::string, int>> alleles;
-    alleles.reserve(allele_count.size());
-    for (const auto& kv : allele_count) alleles.push_back(kv);
-    std::sort(alleles.begin(), alleles.end(),
-              [&](const std::pair<std::string, int>& lhs, const std::pair<std::string, int>& rhs) {
-                if (lhs.second != rhs.second) return lhs.second > rhs.second;
-                return first_seen[lhs.first] < first_seen[rhs.first];
-              });
-
-    const std::string major = alleles[0].first;
-    const std::string minor = alleles[1].first;
 
+    const unsigned char* codes = enc.marker(j);
     int minor_copies = 0;
     int called_alleles = 0;
     for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (is_missing_allele(a) || is_missing_allele(b)) continue;
-      const bool a_known = (a == major || a == minor);
-      const bool b_known = (b == major || b == minor);
-      if (!a_known || !b_known) continue;
-      minor_copies += static_cast<int>(a == minor) + static_cast<int>(b == minor);
+      const int d = minor_allele_copies(codes[2 * i], codes[2 * i + 1], major, minor);
+      if (d < 0) continue;
+      minor_copies += d;
       called_alleles += 2;
     }
-
     if (called_alleles > 0) {
-      maf[j] = static_cast<double>(minor_copies) / static_cast<double>(called_alleles);
-    } else {
-      maf[j] = NA_REAL;
+      maf_p[j] = static_cast<double>(minor_copies) / static_cast<double>(called_alleles);
     }
-  }
+  });
 
   return maf;
 }
 
-// PLINK-aligned HWE exact p-values from PED-style genotype strings.
+// PLINK-aligned HWE exact p-values from PED-style genotype strings
+// (midp = TRUE gives the mid-p variant, as PLINK's --hwe midp).
 // Missing rules match gvr_call_rate_from_ped_strings_cpp.
 // For loci with >2 observed alleles, keep top-2 alleles by count and treat others as missing.
 // [[Rcpp::export]]
-NumericVector gvr_hwe_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
-  const int n = geno_pairs.nrow();
-  const int m = geno_pairs.ncol();
+NumericVector gvr_hwe_from_ped_strings_cpp(SEXP geno_pairs, int n_threads = 0,
+                                           bool midp = false) {
+  n_threads = gvr::resolve_threads(n_threads);
+  std::unique_ptr<PedEncoding> owned;
+  const PedEncoding& enc = ped_encoding(geno_pairs, n_threads, owned);
+  const int n = enc.n_samples();
+  const int m = enc.n_markers();
   NumericVector pvals(m, NA_REAL);
   if (n == 0 || m == 0) return pvals;
-
-  for (int j = 0; j < m; ++j) {
-    std::unordered_map<std::string, int> allele_count;
-    std::unordered_map<std::string, int> first_seen;
-    int seen_rank = 0;
-
-    for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (!is_missing_allele(a)) {
-        if (first_seen.find(a) == first_seen.end()) first_seen[a] = seen_rank++;
-        allele_count[a]++;
-      }
-      if (!is_missing_allele(b)) {
-        if (first_seen.find(b) == first_seen.end()) first_seen[b] = seen_rank++;
-        allele_count[b]++;
-      }
+  double* pvals_p = pvals.begin();
+
+  std::vector<gvr::HweExact> hwe = gvr::hwe_engines(n_threads);
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    int major = 0, minor = 0;
+    enc.top_two(j, major, minor);
+    if (major == 0) return;
+    if (minor == 0) {
+      pvals_p[j] = 1.0;
+      return;
     }
 
-    if (allele_count.empty()) {
-      pvals[j] = NA_REAL;
-      continue;
-    }
-    if (allele_count.size() == 1) {
-      pvals[j] = 1.0;
-      continue;
-    }
-
-    std::vector<std::pair<std::string, int>> alleles;
-    alleles.reserve(allele_count.size());
-    for (const auto& kv : allele_count) alleles.push_back(kv);
-    std::sort(alleles.begin(), alleles.end(),
-              [&](const std::pair<std::string, int>& lhs, const std::pair<std::string, int>& rhs) {
-                if (lhs.second != rhs.second) return lhs.second > rhs.second;
-                return first_seen[lhs.first] < first_seen[rhs.first];
-              });
-
-    const std::string major = alleles[0].first;
-    const std::string minor = alleles[1].first;
-
-    int hom_major = 0;
-    int het = 0;
-    int hom_minor = 0;
-    int valid = 0;
+    const unsigned char* codes = enc.marker(j);
+    int tally[3] = {0, 0, 0};
     for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (is_missing_allele(a) || is_missing_allele(b)) continue;
-      const bool a_known = (a == major || a == minor);
-      const bool b_known = (b == major || b == minor);
-      if (!a_known || !b_known) continue;
-      valid++;
-      if (a == minor && b == minor) hom_minor++;
-      else if (a == major && b == major) hom_major++;
-      else het++;
+      const int d = minor_allele_copies(codes[2 * i], codes[2 * i + 1], major, minor);
+      if (d >= 0) tally[d]++;
     }
-
-    if (valid > 0) {
-      pvals[j] = hwe_exact_pvalue_local(het, hom_major, hom_minor);
+    if (tally[0] + tally[1] + tally[2] > 0) {
+      pvals_p[j] = hwe[t].pvalue(tally[1], tally[0], tally[2], midp);
     }
-  }
+  });
 
   return pvals;
 }
@@ -496,90 +1296,53 @@ NumericVector gvr_hwe_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
 // Missing rules match gvr_call_rate_from_ped_strings_cpp.
 // For loci with >2 observed alleles, keep top-2 alleles by count and treat others as missing.
 // [[Rcpp::export]]
-NumericVector gvr_individual_het_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
-  const int n = geno_pairs.nrow();
-  const int m = geno_pairs.ncol();
+NumericVector gvr_individual_het_from_ped_strings_cpp(SEXP geno_pairs, int n_threads = 0) {
+  n_threads = gvr::resolve_threads(n_threads);
+  std::unique_ptr<PedEncoding> owned;
+  const PedEncoding& enc = ped_encoding(geno_pairs, n_threads, owned);
+  const int n = enc.n_samples();
+  const int m = enc.n_markers();
   NumericVector out(n, NA_REAL);
   if (n == 0 || m == 0) return out;
 
+  // First pass: top-2 alleles of each marker and whether it is polymorphic.
+  std::vector<int> major_allele(m, 0), minor_allele(m, 0);
   std::vector<unsigned char> polymorphic(m, 0);
-  std::vector<std::string> major_allele(m), minor_allele(m);
-
-  // First pass: identify per-marker top2 alleles and polymorphic markers.
-  for (int j = 0; j < m; ++j) {
-    std::unordered_map<std::string, int> allele_count;
-    std::unordered_map<std::string, int> first_seen;
-    int seen_rank = 0;
-
-    for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (!is_missing_allele(a)) {
-        if (first_seen.find(a) == first_seen.end()) first_seen[a] = seen_rank++;
-        allele_count[a]++;
-      }
-      if (!is_missing_allele(b)) {
-        if (first_seen.find(b) == first_seen.end()) first_seen[b] = seen_rank++;
-        allele_count[b]++;
-      }
-    }
-
-    if (allele_count.empty()) continue;
-
-    std::vector<std::pair<std::string, int>> alleles;
-    alleles.reserve(allele_count.size());
-    for (const auto& kv : allele_count) alleles.push_back(kv);
-    std::sort(alleles.begin(), alleles.end(),
-              [&](const std::pair<std::string, int>& lhs, const std::pair<std::string, int>& rhs) {
-                if (lhs.second != rhs.second) return lhs.second > rhs.second;
-                return first_seen[lhs.first] < first_seen[rhs.first];
-              });
-
-    if (alleles.size() == 1) {
-      major_allele[j] = alleles[0].first;
-      minor_allele[j] = alleles[0].first;
-      continue;
-    }
-
-    major_allele[j] = alleles[0].first;
-    minor_allele[j] = alleles[1].first;
-
+  gvr::parallel_markers(m, n_threads, [&](int j, int) {
+    int major = 0, minor = 0;
+    enc.top_two(j, major, minor);
+    if (minor == 0) return;
+    major_allele[j] = major;
+    minor_allele[j] = minor;
+
+    const unsigned char* codes = enc.marker(j);
     int minor_copies = 0;
     int called_alleles = 0;
     for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (is_missing_allele(a) || is_missing_allele(b)) continue;
-      const bool a_known = (a == major_allele[j] || a == minor_allele[j]);
-      const bool b_known = (b == major_allele[j] || b == minor_allele[j]);
-      if (!a_known || !b_known) continue;
-      minor_copies += static_cast<int>(a == minor_allele[j]) + static_cast<int>(b == minor_allele[j]);
+      const int d = minor_allele_copies(codes[2 * i], codes[2 * i + 1], major, minor);
+      if (d < 0) continue;
+      minor_copies += d;
       called_alleles += 2;
     }
     if (called_alleles > 0 && minor_copies > 0 && minor_copies < called_alleles) {
       polymorphic[j] = 1;
     }
-  }
+  });
 
-  // Second pass: compute per-individual heterozygosity rate across polymorphic loci.
-  for (int i = 0; i < n; ++i) {
-    int valid = 0;
-    int het = 0;
-    for (int j = 0; j < m; ++j) {
-      if (!polymorphic[j]) continue;
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (is_missing_allele(a) || is_missing_allele(b)) continue;
-      const bool a_known = (a == major_allele[j] || a == minor_allele[j]);
-      const bool b_known = (b == major_allele[j] || b == minor_allele[j]);
-      if (!a_known || !b_known) continue;
-      valid++;
-      if (a != b) het++;
+  // Second pass: per-individual heterozygosity rate across polymorphic loci.
+  std::vector<int> valid(n, 0), het(n, 0);
+  for (int j = 0; j < m; ++j) {
+    if (!polymorphic[j]) continue;
+    const unsigned char* codes = enc.marker(j);
+    for (int i = 0; i < n; ++i) {
+      const int d = minor_allele_copies(codes[2 * i], codes[2 * i + 1], major_allele[j], minor_allele[j]);
+      if (d < 0) continue;
+      valid[i]++;
+      het[i] += (d == 1);
     }
-    if (valid > 0) out[i] = static_cast<double>(het) / static_cast<double>(valid);
+  }
+  for (int i = 0; i < n; ++i) {
+    if (valid[i] > 0) out[i] = static_cast<double>(het[i]) / static_cast<double>(valid[i]);
   }
 
   return out;
@@ -588,66 +1351,33 @@ NumericVector gvr_individual_het_from_ped_strings_cpp(CharacterMatrix geno_pairs
 // PLINK-aligned dosage matrix from PED-style genotype strings.
 // Missing rules match gvr_call_rate_from_ped_strings_cpp.
 // For loci with >2 observed alleles, keep top-2 alleles by count and treat others as missing.
-// Output dosage counts copies of minor allele (0/1/2), with NA for missing.
+// Output dosage counts copies of minor allele (0/1/2), with NA for missing;
+// output = "raw" or "packed" returns it in 1 byte or 2 bits per genotype
+// (see DosageSink), which the gvr_* kernels accept directly.
 // [[Rcpp::export]]
-NumericMatrix gvr_dosage_from_ped_strings_cpp(CharacterMatrix geno_pairs) {
-  const int n = geno_pairs.nrow();
-  const int m = geno_pairs.ncol();
-  NumericMatrix dosage(n, m);
-  std::fill(dosage.begin(), dosage.end(), NA_REAL);
-  if (n == 0 || m == 0) return dosage;
-
-  for (int j = 0; j < m; ++j) {
-    std::unordered_map<std::string, int> allele_count;
-    std::unordered_map<std::string, int> first_seen;
-    int seen_rank = 0;
-
+SEXP gvr_dosage_from_ped_strings_cpp(SEXP geno_pairs, int n_threads = 0,
+                                     std::string output = "double") {
+  n_threads = gvr::resolve_threads(n_threads);
+  std::unique_ptr<PedEncoding> owned;
+  const PedEncoding& enc = ped_encoding(geno_pairs, n_threads, owned);
+  const int n = enc.n_samples();
+  const int m = enc.n_markers();
+  DosageSink dosage(output, n, m);
+  if (n == 0 || m == 0) return dosage.result();
+  std::vector<signed char> cols((size_t)n_threads * (size_t)n);
+
+  gvr::parallel_markers(m, n_threads, [&](int j, int t) {
+    signed char* col = cols.data() + (size_t)t * (size_t)n;
+    int major = 0, minor = 0;
+    enc.top_two(j, major, minor);
+    const unsigned char* codes = enc.marker(j);
     for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (!is_missing_allele(a)) {
-        if (first_seen.find(a) == first_seen.end()) first_seen[a] = seen_rank++;
-        allele_count[a]++;
-      }
-      if (!is_missing_allele(b)) {
-        if (first_seen.find(b) == first_seen.end()) first_seen[b] = seen_rank++;
-        allele_count[b]++;
-      }
+      // Monomorphic markers (minor == 0) code the observed homozygote as 0.
+      col[i] = major == 0 ? (signed char)-1
+                          : (signed char)minor_allele_copies(codes[2 * i], codes[2 * i + 1], major, minor);
     }
+    dosage.put(j, col);
+  });
 
-    if (allele_count.empty()) continue;
-
-    std::vector<std::pair<std::string, int>> alleles;
-    alleles.reserve(allele_count.size());
-    for (const auto& kv : allele_count) alleles.push_back(kv);
-    std::sort(alleles.begin(), alleles.end(),
-              [&](const std::pair<std::string, int>& lhs, const std::pair<std::string, int>& rhs) {
-                if (lhs.second != rhs.second) return lhs.second > rhs.second;
-                return first_seen[lhs.first] < first_seen[rhs.first];
-              });
-
-    std::string major = alleles[0].first;
-    std::string minor = alleles[0].first;
-    if (alleles.size() > 1) minor = alleles[1].first;
-
-    for (int i = 0; i < n; ++i) {
-      if (geno_pairs(i, j) == NA_STRING) continue;
-      std::string a, b;
-      if (!parse_ped_pair(as<std::string>(geno_pairs(i, j)), a, b)) continue;
-      if (is_missing_allele(a) || is_missing_allele(b)) continue;
-
-      if (major == minor) {
-        if (a == major && b == major) dosage(i, j) = 0.0;
-        continue;
-      }
-
-      const bool a_known = (a == major || a == minor);
-      const bool b_known = (b == major || b == minor);
-      if (!a_known || !b_known) continue;
-      dosage(i, j) = static_cast<double>((a == minor) + (b == minor));
-    }
-  }
-
-  return dosage;
+  return dosage.result();
 }